@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace module
+{
+    struct PoolStats
+    {
+        uint32_t size;
+        uint64_t allocations;
+        uint64_t inUse;
+
+        // free blocks kept in thread caches and the shared lists
+        uint64_t cached;
+    };
+
+    struct AllocatorStats
+    {
+        std::vector<PoolStats> pools;
+
+        // memory reserved for the pools, it isn't returned to the system
+        uint64_t arenaBytes;
+
+        // part of it SQLite doesn't use right now, memory released by SQLite ends up here instead of the system
+        uint64_t retainedBytes;
+
+        // allocations too big for a pool go to malloc
+        uint64_t largeAllocations;
+        uint64_t largeInUse;
+        uint64_t largeBytes;
+    };
+
+    // replaces SQLite's allocator with size-class pools cached per thread, has to be called before SQLite is
+    // initialized (opening a database, registering a VFS) and returns false otherwise
+    bool InstallPoolAllocator();
+
+    bool IsPoolAllocatorInstalled();
+
+    // hands SQLite one region for `pages` pages of the default size (4096), backed by huge pages when asked for and
+    // available; pages of databases with a bigger page size and pages beyond the region use the allocator
+    // same as InstallPoolAllocator, only works before SQLite is initialized
+    bool ReservePageCache(int pages, bool hugePages);
+
+    AllocatorStats GetAllocatorStats();
+} // namespace module
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <string>
+
+namespace module
+{
+    // keeps db (usually ":memory:") mirrored in the file at path: its content is restored from the file right away and
+    // copied back every intervalMs, a few pages at a time from StepBackups so the copy never blocks a pulse for long
+    bool EnableSnapshots(sqlite3* db, const std::string& path, int intervalMs, std::string& error);
+
+    // starts a snapshot now unless one is running, with wait it is finished before returning (or abandoned when the
+    // file stays locked for seconds); fails with the error of this snapshot (wait) or of the last one that failed in
+    // the background
+    bool Snapshot(sqlite3* db, bool wait, std::string& error);
+
+    // writes a last snapshot and closes the file, has to be called before db is closed
+    void DisableSnapshots(sqlite3* db);
+
+    struct BackupJob;
+
+    struct BackupProgress
+    {
+        int pageCount;
+        int remaining;
+
+        // how often the copy started over because another connection changed the source
+        int  restarts;
+        bool done;
+
+        // empty if the backup succeeded or is still running
+        std::string error;
+    };
+
+    // starts an online copy of db into the file at path, copied pagesPerStep pages at a time for at most
+    // maxUsPerPulse every pulse; it fails after more than maxRestarts restarts or once it ran for maxAgeMs (0 for no
+    // limit), the job stays valid until passed to FreeBackup
+    BackupJob* StartBackup(sqlite3* db, const std::string& path, int pagesPerStep, int maxUsPerPulse, int maxRestarts, int maxAgeMs, std::string& error);
+
+    // false if job was already freed
+    bool GetBackupProgress(BackupJob* job, BackupProgress& progress);
+
+    // cancels the copy if it's still running
+    void FreeBackup(BackupJob* job);
+
+    // cancels the running backups of db, has to be called before db is closed
+    void CancelBackups(sqlite3* db);
+
+    // advances snapshots for at most sliceUs and every backup for its own time limit, called every pulse
+    void StepBackups(int sliceUs);
+} // namespace module
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <SDK/SDK.hpp>
+
+#include <sqlite/sqlite3.h>
+
+namespace module
+{
+    // fixed layout blobs for the Universe math types, little endian floats in member order
+    // a column is converted back when its declared type is one of the names below and the size matches
+    enum class BlobType
+    {
+        None,
+        Vector2,
+        Vector3,
+        RGBA,
+        Matrix4x4
+    };
+
+    constexpr int VECTOR2_SIZE   = 2 * sizeof(float);
+    constexpr int VECTOR3_SIZE   = 3 * sizeof(float);
+    constexpr int RGBA_SIZE      = 4;
+    constexpr int MATRIX4X4_SIZE = 16 * sizeof(float);
+
+    inline int GetBlobSize(BlobType type)
+    {
+        switch (type)
+        {
+        case BlobType::Vector2:
+            return VECTOR2_SIZE;
+        case BlobType::Vector3:
+            return VECTOR3_SIZE;
+        case BlobType::RGBA:
+            return RGBA_SIZE;
+        case BlobType::Matrix4x4:
+            return MATRIX4X4_SIZE;
+        default:
+            return 0;
+        }
+    }
+
+    inline BlobType GetBlobType(const char* declType, int size)
+    {
+        if (!declType)
+            return BlobType::None;
+
+        BlobType type = BlobType::None;
+        if (sqlite3_stricmp(declType, "VECTOR2") == 0)
+            type = BlobType::Vector2;
+        else if (sqlite3_stricmp(declType, "VECTOR3") == 0)
+            type = BlobType::Vector3;
+        else if (sqlite3_stricmp(declType, "RGBA") == 0)
+            type = BlobType::RGBA;
+        else if (sqlite3_stricmp(declType, "MATRIX4X4") == 0)
+            type = BlobType::Matrix4x4;
+
+        return GetBlobSize(type) == size ? type : BlobType::None;
+    }
+
+    inline Universe::Math::Vector2 UnpackVector2(const void* data)
+    {
+        float v[2];
+        memcpy(v, data, sizeof(v));
+        return Universe::Math::Vector2(v[0], v[1]);
+    }
+
+    inline Universe::Math::Vector3 UnpackVector3(const void* data)
+    {
+        float v[3];
+        memcpy(v, data, sizeof(v));
+        return Universe::Math::Vector3(v[0], v[1], v[2]);
+    }
+
+    inline Universe::Math::RGBA UnpackRGBA(const void* data)
+    {
+        const uint8_t* v = (const uint8_t*)data;
+        return Universe::Math::RGBA(v[0], v[1], v[2], v[3]);
+    }
+
+    inline Universe::Math::Matrix4x4 UnpackMatrix4x4(const void* data)
+    {
+        Universe::Math::Matrix4x4 matrix;
+        memcpy(matrix.f, data, MATRIX4X4_SIZE);
+        return matrix;
+    }
+
+    inline void PackVector2(void* out, const Universe::Math::Vector2& vec)
+    {
+        float v[2] = { vec.x, vec.y };
+        memcpy(out, v, sizeof(v));
+    }
+
+    inline void PackVector3(void* out, const Universe::Math::Vector3& vec)
+    {
+        float v[3] = { vec.x, vec.y, vec.z };
+        memcpy(out, v, sizeof(v));
+    }
+
+    inline void PackRGBA(void* out, const Universe::Math::RGBA& color)
+    {
+        uint8_t v[4] = { color.r, color.g, color.b, color.a };
+        memcpy(out, v, sizeof(v));
+    }
+
+    inline void PackMatrix4x4(void* out, const Universe::Math::Matrix4x4& matrix)
+    {
+        memcpy(out, matrix.f, MATRIX4X4_SIZE);
+    }
+} // namespace module
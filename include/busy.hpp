@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <cstdint>
+
+namespace module
+{
+    // bucket i counts waits that took less than 2^i milliseconds, the last one everything longer
+    constexpr int BUSY_HISTOGRAM_BUCKETS = 12;
+
+    struct BusyStats
+    {
+        // times a statement found the database locked, and how often it retried in total
+        uint64_t waits;
+        uint64_t retries;
+
+        // waits that gave up after the timeout, the statement failed with SQLITE_BUSY
+        uint64_t timeouts;
+
+        uint64_t totalUs;
+        uint64_t maxUs;
+        uint64_t histogram[BUSY_HISTOGRAM_BUCKETS];
+    };
+
+    // how long a statement waits for a lock at most on connections of the main thread and of workers, and the
+    // longest single sleep between retries
+    void SetBusyLimits(int timeoutMs, int workerTimeoutMs, int maxBackoffMs);
+
+    // installs the backoff busy handler on db, a wait also ends once the deadline of the running call passed
+    void EnableBusyHandler(sqlite3* db, bool worker = false);
+
+    // has to be called before db is closed
+    void DisableBusyHandler(sqlite3* db);
+
+    bool GetBusyStats(sqlite3* db, BusyStats& stats, bool reset);
+} // namespace module
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace module
+{
+    struct Session;
+
+    // records the changes made to tables (all tables when empty) through db, tables without a primary key are skipped
+    Session* CreateSession(sqlite3* db, const std::vector<std::string>& tables, std::string& error);
+
+    // false if session was already deleted
+    bool IsSession(Session* session);
+
+    // the changes recorded so far, with reset recording starts over afterwards so the next changeset only has newer ones
+    bool GetChangeset(Session* session, bool reset, std::vector<uint8_t>& changeset, std::string& error);
+
+    void DeleteSession(Session* session);
+
+    // deletes the sessions of db, has to be called before db is closed
+    void DeleteSessions(sqlite3* db);
+
+    // conflicting rows are replaced, changes to rows that don't exist anymore are skipped, constraint errors abort
+    bool ApplyChangeset(sqlite3* db, const std::vector<uint8_t>& changeset, std::string& error);
+
+    bool InvertChangeset(const std::vector<uint8_t>& changeset, std::vector<uint8_t>& inverted);
+} // namespace module
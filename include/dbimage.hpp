@@ -0,0 +1,16 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <string>
+
+namespace module
+{
+    // opens a read-only connection on an in-memory copy of the database at path (-wal content included), it is read
+    // once and the image shared by every connection opened on the same file, reads never touch the filesystem or take locks
+    // changes made to the file after it was loaded aren't seen until every connection on it is closed
+    bool OpenImage(const std::string& path, sqlite3** db, std::string& error);
+
+    // closes db if it was opened by OpenImage and drops its reference to the image, returns false for other connections
+    bool CloseImage(sqlite3* db);
+} // namespace module
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <atomic>
+#include <chrono>
+
+namespace module
+{
+    struct Deadline;
+
+    // installs the progress handler interrupting statements of db that run past their deadline
+    void EnableDeadlines(sqlite3* db);
+
+    // has to be called before db is closed
+    void DisableDeadlines(sqlite3* db);
+
+    // timeout of every call on db that doesn't pass its own, 0 for none
+    void SetDefaultTimeout(sqlite3* db, int timeoutMs);
+    int  GetDefaultTimeout(sqlite3* db);
+
+    // when the call running on db has to be done, time_point::max() without a deadline
+    std::chrono::steady_clock::time_point GetDeadline(sqlite3* db);
+
+    // arms the deadline of db for as long as it is in scope, statements still running after it fail with
+    // SQLITE_INTERRUPT; timeoutMs < 0 uses the connection's default, 0 means no limit
+    class DeadlineScope
+    {
+    public:
+        DeadlineScope(sqlite3* db, int timeoutMs = -1);
+        // statements also stop as soon as *cancelled is set, from any thread
+        DeadlineScope(sqlite3* db, std::chrono::steady_clock::time_point until, const std::atomic<bool>* cancelled = nullptr);
+        ~DeadlineScope();
+
+        DeadlineScope(const DeadlineScope&)            = delete;
+        DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+        // whether a statement was stopped because the deadline passed
+        bool Interrupted() const;
+
+    private:
+        Deadline*                             m_deadline;
+        std::chrono::steady_clock::time_point m_previous;
+        bool                                  m_previousInterrupted;
+        const std::atomic<bool>*              m_previousCancelled;
+    };
+} // namespace module
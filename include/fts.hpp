@@ -0,0 +1,16 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <string>
+#include <vector>
+
+namespace module
+{
+    // "<table>_fts" external content FTS5 table over the given columns, kept in sync with the table by triggers
+    std::string GetFtsIndexName(const std::string& table);
+    int         CreateFtsIndex(sqlite3* db, const std::string& table, const std::vector<std::string>& columns, std::string& error);
+
+    // ?1 match expression, ?2 limit; the snippet column is an index into the columns, -1 for any, -2 for no snippet
+    std::string GetFtsQuery(const std::string& table, int snippetColumn);
+} // namespace module
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <cstdint>
+
+namespace module
+{
+    // delays injected by the "latency" VFS, all zero means pass-through
+    struct LatencyConfig
+    {
+        uint32_t readUs;
+        uint32_t writeUs;
+        uint32_t syncUs;
+
+        // on every xLock, xUnlock, xCheckReservedLock and xShmLock
+        uint32_t lockUs;
+
+        // random extra delay of up to jitterUs on every operation
+        uint32_t jitterUs;
+
+        // every stallEvery-th sync additionally blocks for stallMs, like a disk flushing its cache
+        uint32_t stallEvery;
+        uint32_t stallMs;
+    };
+
+    // bucket i counts pulses whose main thread spent less than 2^i milliseconds in the VFS, the last one everything longer
+    constexpr int LATENCY_HISTOGRAM_BUCKETS = 12;
+
+    // time the main thread spent in "latency" VFS calls per pulse, how injected delays turn into tick stalls
+    struct LatencyStats
+    {
+        uint64_t pulses;
+        uint64_t totalUs;
+        uint64_t maxUs;
+        uint64_t histogram[LATENCY_HISTOGRAM_BUCKETS];
+    };
+
+    // "latency" VFS wrapping the default one to simulate slow disks, only built with SQLMODULE_LATENCY_VFS
+    // the calling thread is taken as the main thread
+    void RegisterLatencyVfs(const LatencyConfig& config);
+
+    // adds the main thread's VFS time since the last call to the stats as one pulse, called every pulse
+    void EndLatencyPulse();
+
+    void GetLatencyStats(LatencyStats& stats, bool reset);
+} // namespace module
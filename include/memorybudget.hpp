@@ -0,0 +1,19 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+namespace module
+{
+    // module-wide memory budget for SQLite, the hard heap limit; the share actually handed out (soft heap limit and
+    // page cache sizes) shrinks as the server fills up and grows back when it's quiet
+    void SetMemoryBudget(sqlite3_int64 bytes);
+
+    sqlite3_int64 GetMemoryBudget();
+
+    // connections whose cache size is managed by the budget
+    void TrackDatabase(sqlite3* db);
+    void UntrackDatabase(sqlite3* db);
+
+    // recomputes the limits for the current player count, called every pulse but only does work about once a second
+    void RebalanceMemory(int players, int maxPlayers);
+} // namespace module
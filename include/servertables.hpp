@@ -0,0 +1,12 @@
+#pragma once
+
+#include <SDK/SDK.hpp>
+
+#include <sqlite/sqlite3.h>
+
+namespace module
+{
+    // read-only eponymous virtual tables over IServerAPI:
+    // server_players(id, name) with one row per connected client, server_info with a single row
+    int RegisterServerTables(sqlite3* db, Universe::ModuleAPI::IServerAPI* server);
+} // namespace module
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <string>
+
+namespace module
+{
+    // vec3_dist, vec3_within, vec2_dist, aabb_contains and vec3_x/y/z over the VECTOR2/VECTOR3 blob layout
+    int RegisterSpatialFunctions(sqlite3* db);
+
+    // "<table>_rtree" R*Tree over a VECTOR3 column, kept in sync with the table by triggers
+    // the triggers call vec3_x/y/z, so the table can only be written by connections that have the spatial functions
+    std::string GetSpatialIndexName(const std::string& table);
+    int         CreateSpatialIndex(sqlite3* db, const std::string& table, const std::string& idColumn, const std::string& posColumn, std::string& error);
+
+    // refills the R*Tree from the table, for tables changed while the triggers were missing
+    int RebuildSpatialIndex(sqlite3* db, const std::string& table, const std::string& idColumn, const std::string& posColumn, std::string& error);
+
+    // ?1-?3 position and ?4 radius, or ?1-?3 min and ?4-?6 max corner with box
+    std::string GetSpatialQuery(const std::string& table, const std::string& idColumn, const std::string& posColumn, bool box);
+} // namespace module
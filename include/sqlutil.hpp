@@ -0,0 +1,48 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <string>
+#include <vector>
+
+namespace module
+{
+    inline std::string QuoteIdentifier(const std::string& name)
+    {
+        // %w escapes identifiers for use inside double quotes
+        char*       quoted = sqlite3_mprintf("\"%w\"", name.c_str());
+        std::string result = quoted;
+        sqlite3_free(quoted);
+        return result;
+    }
+
+    inline bool TableExists(sqlite3* db, const std::string& name)
+    {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?", -1, &stmt, 0) != SQLITE_OK)
+            return false;
+
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        bool exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+
+        return exists;
+    }
+
+    // names of the columns of a table (virtual ones included) in declaration order, empty if it doesn't exist
+    inline std::vector<std::string> GetTableColumns(sqlite3* db, const std::string& name)
+    {
+        std::vector<std::string> columns;
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT name FROM pragma_table_info(?) ORDER BY cid", -1, &stmt, 0) != SQLITE_OK)
+            return columns;
+
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+            columns.push_back((const char*)sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
+
+        return columns;
+    }
+} // namespace module
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace module
+{
+    enum IoOperation
+    {
+        IO_READ,
+        IO_WRITE,
+        IO_SYNC,
+        IO_LOCK,
+        IO_SHMMAP,
+        IO_OPERATION_COUNT
+    };
+
+    // bucket i counts operations that took less than 2^i microseconds, the last one everything slower
+    constexpr int IO_HISTOGRAM_BUCKETS = 16;
+
+    struct IoOperationStats
+    {
+        uint64_t count;
+        uint64_t bytes;
+        uint64_t totalUs;
+        uint64_t maxUs;
+        uint64_t histogram[IO_HISTOGRAM_BUCKETS];
+    };
+
+    using IoFileStats = std::array<IoOperationStats, IO_OPERATION_COUNT>;
+
+    // "stats" VFS wrapping the default one, selected with the zVfs argument of sqlite3_open
+    void RegisterStatsVfs();
+
+    const char* GetIoOperationName(int operation);
+
+    // counters per file name (database, journal and wal separately), accumulated since the last reset
+    std::map<std::string, IoFileStats> GetIoStats(bool reset);
+} // namespace module
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+namespace module
+{
+    // "io_uring" VFS wrapping the default unix VFS: database, journal and wal writes are queued and submitted as one
+    // batch when SQLite syncs (or touches any file again), sequential reads are prefetched with fadvise.
+    // Behaves exactly like the wrapped VFS when io_uring isn't available (other platforms, old kernels, seccomp).
+    void RegisterUringVfs();
+} // namespace module
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <sqlite/sqlite3.h>
+
+namespace module
+{
+    // base of the file struct of a shim VFS, the real file is allocated right behind the shim's own struct
+    struct ShimFile
+    {
+        sqlite3_file  base;
+        sqlite3_file* real;
+    };
+
+    using ShimOpen = int (*)(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags);
+
+    inline sqlite3_vfs* GetRealVfs(sqlite3_vfs* vfs)
+    {
+        return (sqlite3_vfs*)vfs->pAppData;
+    }
+
+    inline sqlite3_file* GetRealFile(sqlite3_file* file)
+    {
+        return ((ShimFile*)file)->real;
+    }
+
+    // sets up a VFS that forwards everything except xOpen to real (kept in pAppData)
+    // fileSize is sizeof the shim's file struct, which has to start with ShimFile
+    void InitShimVfs(sqlite3_vfs* vfs, sqlite3_vfs* real, const char* name, int fileSize, ShimOpen open);
+
+    // opens the real file for a shim's xOpen, the shim methods are only installed when that succeeded
+    // files whose real methods are an older version get a copy of methods with that version and the newer entries unset
+    int OpenShimFile(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags, const sqlite3_io_methods* methods);
+
+    // io methods that only forward to the real file, shims replace the ones they are interested in
+    sqlite3_io_methods GetShimIoMethods();
+} // namespace module
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+
+namespace module
+{
+    // higher classes run first, lower ones only when nothing else waits or once they aged
+    enum class Priority
+    {
+        Interactive,
+        Normal,
+        Background
+    };
+
+    constexpr int PRIORITY_COUNT = 3;
+
+    const char* GetPriorityName(Priority priority);
+    bool        ParsePriority(const char* name, Priority& priority);
+
+    using JobId = uint64_t;
+
+    // the script VM a job was submitted from, jobs of different resources take turns within a class
+    using ResourceId = int;
+
+    struct QueueStats
+    {
+        // jobs waiting right now and jobs that started since the last reset
+        uint64_t depth;
+        uint64_t started;
+
+        // time between submitting and starting a job
+        uint64_t totalWaitUs;
+        uint64_t maxWaitUs;
+    };
+
+    struct ResourceStats
+    {
+        // jobs waiting and running right now
+        uint64_t queued;
+        uint64_t running;
+
+        // jobs that finished and jobs refused because the queue limit was reached
+        uint64_t completed;
+        uint64_t rejected;
+
+        // time workers spent running the resource's jobs
+        uint64_t dbTimeUs;
+    };
+
+    // threads are started with the first job; with more than one worker the first only takes interactive jobs,
+    // so those never wait behind long jobs, and jobs move up one class for every agingMs they waited
+    void ConfigureWorkers(int workerCount, int agingMs);
+
+    // jobs a single resource may have running and waiting at the same time, 0 for no limit
+    void SetResourceLimits(int maxRunning, int maxQueued);
+
+    // 0 if the resource already has the maximum number of jobs waiting
+    JobId SubmitJob(ResourceId resource, Priority priority, std::function<void()> run);
+
+    // removes a job that didn't start yet, false if it's running or finished
+    bool CancelJob(JobId id);
+
+    void GetQueueStats(QueueStats (&stats)[PRIORITY_COUNT], bool reset);
+
+    std::map<ResourceId, ResourceStats> GetResourceStats(bool reset);
+} // namespace module
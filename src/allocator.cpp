@@ -0,0 +1,483 @@
+#include "allocator.hpp"
+
+#include <sqlite/sqlite3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+    #include <sys/mman.h>
+#endif
+
+namespace module
+{
+    // 16 byte steps up to 128, then four classes per power of two up to 32k
+    constexpr int      POOL_COUNT    = 40;
+    constexpr uint32_t POOL_MAX_SIZE = 32768;
+    constexpr uint32_t LARGE_POOL    = ~0u;
+
+    constexpr size_t ARENA_CHUNK_SIZE = 1024 * 1024;
+
+    constexpr int    PAGECACHE_PAGE_SIZE = 4096;
+    constexpr size_t HUGE_PAGE_SIZE      = 2 * 1024 * 1024;
+
+    // a thread cache keeps about this much per pool before handing blocks back to the shared list
+    constexpr size_t THREAD_CACHE_BYTES = 256 * 1024;
+
+    // in front of every block, keeps the returned memory 8 byte aligned as SQLite requires
+    struct BlockHeader
+    {
+        uint32_t pool;
+        uint32_t size;
+    };
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // only written by the owning thread, read by GetAllocatorStats
+    struct PoolCounters
+    {
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> frees;
+        std::atomic<uint64_t> cached;
+    };
+
+    struct ThreadCounters
+    {
+        PoolCounters pools[POOL_COUNT];
+    };
+
+    struct SharedPool
+    {
+        std::mutex mutex;
+        FreeBlock* blocks = nullptr;
+        uint64_t   count  = 0;
+    };
+
+    struct ThreadCache
+    {
+        FreeBlock*     blocks[POOL_COUNT] = {};
+        uint32_t       counts[POOL_COUNT] = {};
+        char*          arena              = nullptr;
+        size_t         arenaLeft          = 0;
+        ThreadCounters counters           = {};
+
+        ThreadCache();
+        ~ThreadCache();
+    };
+
+    static bool       s_installed;
+    static SharedPool s_sharedPools[POOL_COUNT];
+
+    static std::atomic<uint64_t> s_arenaBytes;
+    static std::atomic<uint64_t> s_largeAllocations;
+    static std::atomic<uint64_t> s_largeFrees;
+    static std::atomic<uint64_t> s_largeBytes;
+
+    // counters of live threads, and the sum of the ones that exited
+    static std::mutex                   s_countersMutex;
+    static std::vector<ThreadCounters*> s_threadCounters;
+    static ThreadCounters               s_exitedCounters;
+
+    enum CacheState
+    {
+        CACHE_NONE,
+        CACHE_ALIVE,
+        CACHE_DESTROYED
+    };
+
+    // SQLite may still free memory from other thread_local destructors after the cache is gone
+    static thread_local CacheState  s_cacheState;
+    static thread_local ThreadCache s_cache;
+
+    static uint32_t GetPoolSize(int pool)
+    {
+        if (pool < 8)
+            return (pool + 1) * 16;
+
+        int power = 7 + (pool - 8) / 4;
+        return (1u << power) + ((pool - 8) % 4 + 1) * (1u << (power - 2));
+    }
+
+    static int GetPool(uint32_t size)
+    {
+        if (size <= 128)
+            return size ? (size - 1) / 16 : 0;
+
+        int power = 31 - __builtin_clz(size - 1);
+        return 8 + (power - 7) * 4 + ((size - 1 - (1u << power)) >> (power - 2));
+    }
+
+    static uint32_t GetThreadCacheLimit(int pool)
+    {
+        uint32_t limit = (uint32_t)(THREAD_CACHE_BYTES / GetPoolSize(pool));
+        return limit < 8 ? 8 : limit;
+    }
+
+    static void Increment(std::atomic<uint64_t>& counter, uint64_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static void Decrement(std::atomic<uint64_t>& counter, uint64_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+    }
+
+    ThreadCache::ThreadCache()
+    {
+        std::lock_guard<std::mutex> lock(s_countersMutex);
+        s_threadCounters.push_back(&counters);
+    }
+
+    ThreadCache::~ThreadCache()
+    {
+        s_cacheState = CACHE_DESTROYED;
+
+        // the arena chunks stay alive, blocks carved from them are in use or on the shared lists
+        for (int pool = 0; pool < POOL_COUNT; pool++)
+        {
+            if (!blocks[pool])
+                continue;
+
+            FreeBlock* last = blocks[pool];
+            while (last->next)
+                last = last->next;
+
+            std::lock_guard<std::mutex> lock(s_sharedPools[pool].mutex);
+            last->next                 = s_sharedPools[pool].blocks;
+            s_sharedPools[pool].blocks = blocks[pool];
+            s_sharedPools[pool].count += counts[pool];
+        }
+
+        std::lock_guard<std::mutex> lock(s_countersMutex);
+        for (int pool = 0; pool < POOL_COUNT; pool++)
+        {
+            s_exitedCounters.pools[pool].allocations.fetch_add(counters.pools[pool].allocations, std::memory_order_relaxed);
+            s_exitedCounters.pools[pool].frees.fetch_add(counters.pools[pool].frees, std::memory_order_relaxed);
+        }
+        s_threadCounters.erase(std::find(s_threadCounters.begin(), s_threadCounters.end(), &counters));
+    }
+
+    static ThreadCache* GetThreadCache()
+    {
+        if (s_cacheState == CACHE_DESTROYED)
+            return nullptr;
+
+        s_cacheState = CACHE_ALIVE;
+        return &s_cache;
+    }
+
+    static BlockHeader* AllocateShared(int pool)
+    {
+        SharedPool& shared = s_sharedPools[pool];
+
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        if (shared.blocks)
+        {
+            FreeBlock* block = shared.blocks;
+            shared.blocks    = block->next;
+            shared.count--;
+            return (BlockHeader*)block;
+        }
+        return nullptr;
+    }
+
+    static void FreeShared(int pool, BlockHeader* header)
+    {
+        SharedPool& shared = s_sharedPools[pool];
+
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        ((FreeBlock*)header)->next = shared.blocks;
+        shared.blocks              = (FreeBlock*)header;
+        shared.count++;
+    }
+
+    // takes a batch from the shared list so the mutex isn't hit on every allocation, carves from the arena otherwise
+    static BlockHeader* Refill(ThreadCache* cache, int pool)
+    {
+        SharedPool& shared = s_sharedPools[pool];
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+
+            uint32_t batch = GetThreadCacheLimit(pool) / 2;
+            while (shared.blocks && batch--)
+            {
+                FreeBlock* block    = shared.blocks;
+                shared.blocks       = block->next;
+                block->next         = cache->blocks[pool];
+                cache->blocks[pool] = block;
+                cache->counts[pool]++;
+                shared.count--;
+                Increment(cache->counters.pools[pool].cached);
+            }
+        }
+
+        if (cache->blocks[pool])
+        {
+            FreeBlock* block    = cache->blocks[pool];
+            cache->blocks[pool] = block->next;
+            cache->counts[pool]--;
+            Decrement(cache->counters.pools[pool].cached);
+            return (BlockHeader*)block;
+        }
+
+        size_t blockSize = sizeof(BlockHeader) + GetPoolSize(pool);
+        if (cache->arenaLeft < blockSize)
+        {
+            // the rest of the old chunk is lost, at most one block per chunk
+            cache->arena = (char*)malloc(ARENA_CHUNK_SIZE);
+            if (!cache->arena)
+            {
+                cache->arenaLeft = 0;
+                return nullptr;
+            }
+            cache->arenaLeft = ARENA_CHUNK_SIZE;
+            s_arenaBytes.fetch_add(ARENA_CHUNK_SIZE, std::memory_order_relaxed);
+        }
+
+        auto* header = (BlockHeader*)cache->arena;
+        cache->arena += blockSize;
+        cache->arenaLeft -= blockSize;
+        return header;
+    }
+
+    // hands half of an overfull thread cache to the shared list, blocks freed by other threads would pile up otherwise
+    static void Drain(ThreadCache* cache, int pool)
+    {
+        uint32_t count = cache->counts[pool] / 2;
+
+        FreeBlock* first = cache->blocks[pool];
+        FreeBlock* last  = first;
+        for (uint32_t i = 1; i < count; i++)
+            last = last->next;
+
+        cache->blocks[pool] = last->next;
+        cache->counts[pool] -= count;
+        Decrement(cache->counters.pools[pool].cached, count);
+
+        SharedPool& shared = s_sharedPools[pool];
+
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        last->next    = shared.blocks;
+        shared.blocks = first;
+        shared.count += count;
+    }
+
+    static void* PoolMalloc(int size)
+    {
+        BlockHeader* header;
+
+        if ((uint32_t)size > POOL_MAX_SIZE)
+        {
+            header = (BlockHeader*)malloc(sizeof(BlockHeader) + size);
+            if (!header)
+                return nullptr;
+
+            header->pool = LARGE_POOL;
+            s_largeAllocations.fetch_add(1, std::memory_order_relaxed);
+            s_largeBytes.fetch_add(size, std::memory_order_relaxed);
+        }
+        else
+        {
+            int          pool  = GetPool(size);
+            ThreadCache* cache = GetThreadCache();
+            if (!cache)
+                header = AllocateShared(pool);
+            else if (cache->blocks[pool])
+            {
+                header              = (BlockHeader*)cache->blocks[pool];
+                cache->blocks[pool] = cache->blocks[pool]->next;
+                cache->counts[pool]--;
+                Decrement(cache->counters.pools[pool].cached);
+            }
+            else
+                header = Refill(cache, pool);
+
+            if (!header)
+                return nullptr;
+
+            header->pool = pool;
+            if (cache)
+                Increment(cache->counters.pools[pool].allocations);
+            else
+                s_exitedCounters.pools[pool].allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        header->size = size;
+        return header + 1;
+    }
+
+    static void PoolFree(void* ptr)
+    {
+        auto* header = (BlockHeader*)ptr - 1;
+
+        if (header->pool == LARGE_POOL)
+        {
+            s_largeFrees.fetch_add(1, std::memory_order_relaxed);
+            s_largeBytes.fetch_sub(header->size, std::memory_order_relaxed);
+            free(header);
+            return;
+        }
+
+        int          pool  = header->pool;
+        ThreadCache* cache = GetThreadCache();
+        if (!cache)
+        {
+            s_exitedCounters.pools[pool].frees.fetch_add(1, std::memory_order_relaxed);
+            FreeShared(pool, header);
+            return;
+        }
+
+        ((FreeBlock*)header)->next = cache->blocks[pool];
+        cache->blocks[pool]        = (FreeBlock*)header;
+        cache->counts[pool]++;
+        Increment(cache->counters.pools[pool].frees);
+        Increment(cache->counters.pools[pool].cached);
+
+        if (cache->counts[pool] > GetThreadCacheLimit(pool))
+            Drain(cache, pool);
+    }
+
+    static int PoolSize(void* ptr)
+    {
+        auto* header = (BlockHeader*)ptr - 1;
+        return header->pool == LARGE_POOL ? header->size : GetPoolSize(header->pool);
+    }
+
+    static void* PoolRealloc(void* ptr, int size)
+    {
+        auto* header = (BlockHeader*)ptr - 1;
+        if (header->pool != LARGE_POOL && (uint32_t)size <= GetPoolSize(header->pool))
+        {
+            header->size = size;
+            return ptr;
+        }
+
+        void* result = PoolMalloc(size);
+        if (!result)
+            return nullptr;
+
+        memcpy(result, ptr, std::min(PoolSize(ptr), size));
+        PoolFree(ptr);
+        return result;
+    }
+
+    static int PoolRoundup(int size)
+    {
+        if ((uint32_t)size > POOL_MAX_SIZE)
+            return (size + 7) & ~7;
+        return GetPoolSize(GetPool(size));
+    }
+
+    static int PoolInit(void*)
+    {
+        return SQLITE_OK;
+    }
+
+    static void PoolShutdown(void*)
+    {
+    }
+
+    bool InstallPoolAllocator()
+    {
+        static const sqlite3_mem_methods methods = { PoolMalloc, PoolFree, PoolRealloc, PoolSize, PoolRoundup, PoolInit, PoolShutdown, nullptr };
+
+        s_installed = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) == SQLITE_OK;
+        return s_installed;
+    }
+
+    bool IsPoolAllocatorInstalled()
+    {
+        return s_installed;
+    }
+
+    static void* ReserveRegion(size_t size, bool hugePages)
+    {
+#ifdef __linux__
+        void* region = MAP_FAILED;
+        if (hugePages)
+            region = mmap(nullptr, (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        // no reserved huge pages, transparent ones are the next best thing
+        if (region == MAP_FAILED)
+        {
+            region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED)
+                return nullptr;
+            if (hugePages)
+                madvise(region, size, MADV_HUGEPAGE);
+        }
+        return region;
+#else
+        (void)hugePages;
+        return malloc(size);
+#endif
+    }
+
+    bool ReservePageCache(int pages, bool hugePages)
+    {
+        int header = 0;
+        if (pages <= 0 || sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header) != SQLITE_OK)
+            return false;
+
+        int   slotSize = (PAGECACHE_PAGE_SIZE + header + 7) & ~7;
+        void* region   = ReserveRegion((size_t)slotSize * pages, hugePages);
+        if (!region)
+            return false;
+
+        // the region lives as long as the process, SQLite keeps using it until shutdown
+        return sqlite3_config(SQLITE_CONFIG_PAGECACHE, region, slotSize, pages) == SQLITE_OK;
+    }
+
+    AllocatorStats GetAllocatorStats()
+    {
+        AllocatorStats stats;
+        stats.arenaBytes       = s_arenaBytes.load(std::memory_order_relaxed);
+        stats.largeAllocations = s_largeAllocations.load(std::memory_order_relaxed);
+        stats.largeInUse       = stats.largeAllocations - s_largeFrees.load(std::memory_order_relaxed);
+        stats.largeBytes       = s_largeBytes.load(std::memory_order_relaxed);
+
+        stats.pools.resize(POOL_COUNT);
+        for (int pool = 0; pool < POOL_COUNT; pool++)
+        {
+            std::lock_guard<std::mutex> lock(s_sharedPools[pool].mutex);
+            stats.pools[pool].size   = GetPoolSize(pool);
+            stats.pools[pool].cached = s_sharedPools[pool].count;
+        }
+
+        // frees can happen on another thread than the allocation, only the sum is meaningful
+        uint64_t frees[POOL_COUNT] = {};
+
+        std::lock_guard<std::mutex> lock(s_countersMutex);
+        for (int pool = 0; pool < POOL_COUNT; pool++)
+        {
+            stats.pools[pool].allocations = s_exitedCounters.pools[pool].allocations.load(std::memory_order_relaxed);
+            frees[pool]                   = s_exitedCounters.pools[pool].frees.load(std::memory_order_relaxed);
+        }
+        for (ThreadCounters* counters : s_threadCounters)
+        {
+            for (int pool = 0; pool < POOL_COUNT; pool++)
+            {
+                stats.pools[pool].allocations += counters->pools[pool].allocations.load(std::memory_order_relaxed);
+                stats.pools[pool].cached += counters->pools[pool].cached.load(std::memory_order_relaxed);
+                frees[pool] += counters->pools[pool].frees.load(std::memory_order_relaxed);
+            }
+        }
+        uint64_t usedBytes = 0;
+        for (int pool = 0; pool < POOL_COUNT; pool++)
+        {
+            stats.pools[pool].inUse = stats.pools[pool].allocations - frees[pool];
+            usedBytes += stats.pools[pool].inUse * (sizeof(BlockHeader) + stats.pools[pool].size);
+        }
+
+        // the counters aren't read atomically together, don't let a race report a huge number
+        stats.retainedBytes = stats.arenaBytes > usedBytes ? stats.arenaBytes - usedBytes : 0;
+        return stats;
+    }
+} // namespace module
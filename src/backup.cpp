@@ -0,0 +1,341 @@
+#include "backup.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace module
+{
+    // pages copied per sqlite3_backup_step call, small enough to check the time slice often
+    constexpr int BACKUP_STEP_PAGES = 16;
+
+    // how long a blocking snapshot waits for a locked file before it's abandoned
+    constexpr int SNAPSHOT_WAIT_MS = 5000;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct SnapshotJob
+    {
+        sqlite3*          file;
+        sqlite3_backup*   backup;
+        Clock::duration   interval;
+        Clock::time_point due;
+
+        // data version of db when the last snapshot started, nothing is copied while it stays the same
+        unsigned int version;
+        bool         failed;
+
+        // of the last failed snapshot, until reported by Snapshot
+        std::string error;
+    };
+
+    struct BackupJob
+    {
+        sqlite3*          source;
+        sqlite3*          file;
+        sqlite3_backup*   backup;
+        int               pagesPerStep;
+        Clock::duration   maxPerPulse;
+        int               maxRestarts;
+        Clock::time_point deadline;
+
+        int         pageCount;
+        int         remaining;
+        int         restarts;
+        std::string error;
+    };
+
+    static std::unordered_map<sqlite3*, SnapshotJob> s_snapshots;
+
+    // jobs handed out to scripts, used to validate the internal pointer of SqlBackup objects
+    static std::unordered_set<BackupJob*> s_backups;
+
+    static unsigned int GetDataVersion(sqlite3* db)
+    {
+        unsigned int version = 0;
+        sqlite3_file_control(db, "main", SQLITE_FCNTL_DATA_VERSION, &version);
+        return version;
+    }
+
+    static bool CopyDatabase(sqlite3* from, sqlite3* to, std::string& error)
+    {
+        sqlite3_backup* backup = sqlite3_backup_init(to, "main", from, "main");
+        if (!backup)
+        {
+            error = sqlite3_errmsg(to);
+            return false;
+        }
+
+        sqlite3_backup_step(backup, -1);
+        if (sqlite3_backup_finish(backup) != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(to);
+            return false;
+        }
+        return true;
+    }
+
+    static void StartSnapshot(sqlite3* db, SnapshotJob& job)
+    {
+        job.version = GetDataVersion(db);
+        job.backup  = sqlite3_backup_init(job.file, "main", db, "main");
+        job.failed  = !job.backup;
+        if (job.failed)
+            job.error = sqlite3_errmsg(job.file);
+    }
+
+    // returns the result of sqlite3_backup_step, the job is done unless that was SQLITE_OK, SQLITE_BUSY or SQLITE_LOCKED
+    static int StepSnapshot(SnapshotJob& job, int pages)
+    {
+        int rc = sqlite3_backup_step(job.backup, pages);
+        if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+            return rc;
+
+        job.failed = sqlite3_backup_finish(job.backup) != SQLITE_OK;
+        if (job.failed)
+            job.error = sqlite3_errmsg(job.file);
+
+        job.backup = nullptr;
+        job.due    = Clock::now() + job.interval;
+        return rc;
+    }
+
+    // gives up when the file stays locked, the snapshot counts as failed and is retried on the next interval
+    static void FinishSnapshot(SnapshotJob& job)
+    {
+        auto end = Clock::now() + std::chrono::milliseconds(SNAPSHOT_WAIT_MS);
+        while (job.backup)
+        {
+            if (StepSnapshot(job, -1) == SQLITE_DONE || !job.backup)
+                break;
+
+            if (Clock::now() >= end)
+            {
+                sqlite3_backup_finish(job.backup);
+                job.backup = nullptr;
+                job.failed = true;
+                job.error  = "snapshot abandoned, the file stayed locked for " + std::to_string(SNAPSHOT_WAIT_MS) + " ms";
+                job.due    = Clock::now() + job.interval;
+                break;
+            }
+            sqlite3_sleep(1);
+        }
+    }
+
+    // a failed snapshot is retried even if nothing changed since
+    static bool NeedsSnapshot(sqlite3* db, SnapshotJob& job)
+    {
+        return job.failed || GetDataVersion(db) != job.version;
+    }
+
+    bool EnableSnapshots(sqlite3* db, const std::string& path, int intervalMs, std::string& error)
+    {
+        sqlite3* file = nullptr;
+        if (sqlite3_open_v2(path.c_str(), &file, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(file);
+            sqlite3_close_v2(file);
+            return false;
+        }
+
+        // picks up where the last session (or crash) left off
+        if (!CopyDatabase(file, db, error))
+        {
+            sqlite3_close_v2(file);
+            return false;
+        }
+
+        auto& job    = s_snapshots[db];
+        job.file     = file;
+        job.backup   = nullptr;
+        job.interval = std::chrono::milliseconds(intervalMs);
+        job.due      = Clock::now() + job.interval;
+        job.version  = GetDataVersion(db);
+        job.failed   = false;
+        return true;
+    }
+
+    bool Snapshot(sqlite3* db, bool wait, std::string& error)
+    {
+        auto it = s_snapshots.find(db);
+        if (it == s_snapshots.end())
+        {
+            error = "snapshots are not enabled for this database";
+            return false;
+        }
+
+        auto& job = it->second;
+        error     = job.error;
+        job.error.clear();
+
+        if (!job.backup)
+            StartSnapshot(db, job);
+
+        if (wait)
+        {
+            FinishSnapshot(job);
+            error = job.error;
+            job.error.clear();
+        }
+        return error.empty();
+    }
+
+    void DisableSnapshots(sqlite3* db)
+    {
+        auto it = s_snapshots.find(db);
+        if (it == s_snapshots.end())
+            return;
+
+        auto& job = it->second;
+        if (!job.backup && NeedsSnapshot(db, job))
+            StartSnapshot(db, job);
+        FinishSnapshot(job);
+
+        sqlite3_close_v2(job.file);
+        s_snapshots.erase(it);
+    }
+
+    static void FinishBackup(BackupJob* job, const char* error)
+    {
+        if (sqlite3_backup_finish(job->backup) != SQLITE_OK)
+            job->error = sqlite3_errmsg(job->file);
+        else if (error)
+            job->error = error;
+
+        sqlite3_close_v2(job->file);
+        job->backup = nullptr;
+        job->file   = nullptr;
+    }
+
+    static void StepBackup(BackupJob* job)
+    {
+        auto now = Clock::now();
+        if (now >= job->deadline)
+        {
+            FinishBackup(job, "backup took longer than maxAgeMs");
+            return;
+        }
+
+        auto end = now + job->maxPerPulse;
+        while (Clock::now() < end)
+        {
+            int rc = sqlite3_backup_step(job->backup, job->pagesPerStep);
+
+            // SQLite starts over by itself when another connection wrote to the source, then fewer pages are copied
+            // than before; a source that only grew has more remaining but didn't lose any
+            int remaining = sqlite3_backup_remaining(job->backup);
+            int pageCount = sqlite3_backup_pagecount(job->backup);
+            if (pageCount - remaining < job->pageCount - job->remaining)
+                job->restarts++;
+            job->remaining = remaining;
+            job->pageCount = pageCount;
+
+            if (job->maxRestarts && job->restarts > job->maxRestarts)
+            {
+                FinishBackup(job, "backup gave up, the source changed more than maxRestarts times");
+                return;
+            }
+
+            if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+                return;
+            if (rc != SQLITE_OK)
+            {
+                FinishBackup(job, nullptr);
+                return;
+            }
+        }
+    }
+
+    BackupJob* StartBackup(sqlite3* db, const std::string& path, int pagesPerStep, int maxUsPerPulse, int maxRestarts, int maxAgeMs, std::string& error)
+    {
+        sqlite3* file = nullptr;
+        if (sqlite3_open_v2(path.c_str(), &file, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(file);
+            sqlite3_close_v2(file);
+            return nullptr;
+        }
+
+        sqlite3_backup* backup = sqlite3_backup_init(file, "main", db, "main");
+        if (!backup)
+        {
+            error = sqlite3_errmsg(file);
+            sqlite3_close_v2(file);
+            return nullptr;
+        }
+
+        auto* job         = new BackupJob;
+        job->source       = db;
+        job->file         = file;
+        job->backup       = backup;
+        job->pagesPerStep = pagesPerStep > 0 ? pagesPerStep : BACKUP_STEP_PAGES;
+        job->maxPerPulse  = std::chrono::microseconds(maxUsPerPulse);
+        job->maxRestarts  = std::max(maxRestarts, 0);
+        job->deadline     = maxAgeMs > 0 ? Clock::now() + std::chrono::milliseconds(maxAgeMs) : Clock::time_point::max();
+        job->pageCount    = 0;
+        job->remaining    = 0;
+        job->restarts     = 0;
+
+        s_backups.insert(job);
+        return job;
+    }
+
+    bool GetBackupProgress(BackupJob* job, BackupProgress& progress)
+    {
+        if (!s_backups.count(job))
+            return false;
+
+        progress.pageCount = job->pageCount;
+        progress.remaining = job->remaining;
+        progress.restarts  = job->restarts;
+        progress.done      = !job->backup;
+        progress.error     = job->error;
+        return true;
+    }
+
+    void FreeBackup(BackupJob* job)
+    {
+        if (!s_backups.erase(job))
+            return;
+
+        if (job->backup)
+            FinishBackup(job, nullptr);
+        delete job;
+    }
+
+    void CancelBackups(sqlite3* db)
+    {
+        for (BackupJob* job : s_backups)
+        {
+            if (job->source == db && job->backup)
+                FinishBackup(job, "database was closed");
+        }
+    }
+
+    void StepBackups(int sliceUs)
+    {
+        auto now = Clock::now();
+        auto end = now + std::chrono::microseconds(sliceUs);
+
+        for (auto& [db, job] : s_snapshots)
+        {
+            if (!job.backup && now >= job.due)
+            {
+                if (NeedsSnapshot(db, job))
+                    StartSnapshot(db, job);
+                else
+                    job.due = now + job.interval;
+            }
+
+            while (job.backup && Clock::now() < end && StepSnapshot(job, BACKUP_STEP_PAGES) == SQLITE_OK)
+                ;
+        }
+
+        for (BackupJob* job : s_backups)
+        {
+            if (job->backup)
+                StepBackup(job);
+        }
+    }
+} // namespace module
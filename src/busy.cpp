@@ -0,0 +1,147 @@
+#include "busy.hpp"
+#include "deadline.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+namespace module
+{
+    // first sleep, doubled on every retry up to the max backoff
+    constexpr int BUSY_MIN_BACKOFF_US = 100;
+
+    struct BusyState
+    {
+        sqlite3*  db;
+        bool      worker;
+        BusyStats stats;
+
+        // time slept in the current wait, it's only known to be over once the next one starts or stats are read
+        uint64_t waitUs;
+    };
+
+    static int s_busyTimeoutUs       = 250 * 1000;
+    static int s_busyWorkerTimeoutUs = 5000 * 1000;
+    static int s_busyMaxBackoffUs    = 20 * 1000;
+
+    static std::mutex                               s_busyMutex;
+    static std::unordered_map<sqlite3*, BusyState*> s_busyStates;
+
+    static void FinishWait(BusyState* state)
+    {
+        if (!state->waitUs)
+            return;
+
+        uint64_t ms     = state->waitUs / 1000;
+        int      bucket = 0;
+        while (bucket < BUSY_HISTOGRAM_BUCKETS - 1 && ms >= (1ull << bucket))
+            bucket++;
+
+        state->stats.histogram[bucket]++;
+        state->stats.totalUs += state->waitUs;
+        if (state->waitUs > state->stats.maxUs)
+            state->stats.maxUs = state->waitUs;
+
+        state->waitUs = 0;
+    }
+
+    static int OnBusy(void* arg, int count)
+    {
+        auto* state = (BusyState*)arg;
+
+        // a call with { timeoutMs } doesn't wait for a lock longer than it may run
+        auto now  = std::chrono::steady_clock::now();
+        auto left = GetDeadline(state->db) - now;
+
+        std::unique_lock<std::mutex> lock(s_busyMutex);
+        if (count == 0)
+        {
+            FinishWait(state);
+            state->stats.waits++;
+        }
+
+        if (state->waitUs >= (uint64_t)(state->worker ? s_busyWorkerTimeoutUs : s_busyTimeoutUs) || left <= std::chrono::steady_clock::duration::zero())
+        {
+            state->stats.timeouts++;
+            FinishWait(state);
+            return 0;
+        }
+
+        // exponential backoff, jittered so connections that collided don't retry in lockstep again
+        thread_local std::minstd_rand random(std::random_device {}());
+
+        int backoff = count < 20 ? std::min(BUSY_MIN_BACKOFF_US << count, s_busyMaxBackoffUs) : s_busyMaxBackoffUs;
+        int sleepUs = backoff / 2 + (int)(random() % (backoff / 2 + 1));
+        if (left < std::chrono::microseconds(sleepUs))
+            sleepUs = (int)std::chrono::duration_cast<std::chrono::microseconds>(left).count() + 1;
+
+        state->stats.retries++;
+        lock.unlock();
+
+        // sleeps overshoot, the histogram counts the time actually spent
+        std::this_thread::sleep_for(std::chrono::microseconds(sleepUs));
+        auto slept = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count();
+
+        lock.lock();
+        state->waitUs += slept;
+        return 1;
+    }
+
+    void SetBusyLimits(int timeoutMs, int workerTimeoutMs, int maxBackoffMs)
+    {
+        s_busyTimeoutUs       = timeoutMs * 1000;
+        s_busyWorkerTimeoutUs = workerTimeoutMs * 1000;
+        s_busyMaxBackoffUs    = std::max(maxBackoffMs * 1000, BUSY_MIN_BACKOFF_US);
+    }
+
+    void EnableBusyHandler(sqlite3* db, bool worker)
+    {
+        auto* state   = new BusyState {};
+        state->db     = db;
+        state->worker = worker;
+        {
+            std::lock_guard<std::mutex> lock(s_busyMutex);
+            s_busyStates[db] = state;
+        }
+
+        sqlite3_busy_handler(db, OnBusy, state);
+    }
+
+    void DisableBusyHandler(sqlite3* db)
+    {
+        BusyState* state = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(s_busyMutex);
+
+            auto it = s_busyStates.find(db);
+            if (it == s_busyStates.end())
+                return;
+
+            state = it->second;
+            s_busyStates.erase(it);
+        }
+
+        sqlite3_busy_handler(db, nullptr, nullptr);
+        delete state;
+    }
+
+    bool GetBusyStats(sqlite3* db, BusyStats& stats, bool reset)
+    {
+        std::lock_guard<std::mutex> lock(s_busyMutex);
+
+        auto it = s_busyStates.find(db);
+        if (it == s_busyStates.end())
+            return false;
+
+        // calls are synchronous, a wait in progress can only be one that already ended
+        FinishWait(it->second);
+
+        stats = it->second->stats;
+        if (reset)
+            it->second->stats = {};
+        return true;
+    }
+} // namespace module
@@ -0,0 +1,151 @@
+#include "changeset.hpp"
+
+#include <unordered_set>
+
+namespace module
+{
+    struct Session
+    {
+        sqlite3*                 db;
+        sqlite3_session*         session;
+        std::vector<std::string> tables;
+    };
+
+    // sessions handed out to scripts, used to validate the internal pointer of SqlSession objects
+    static std::unordered_set<Session*> s_sessions;
+
+    static int Attach(sqlite3* db, const std::vector<std::string>& tables, sqlite3_session** session)
+    {
+        int rc = sqlite3session_create(db, "main", session);
+        if (rc != SQLITE_OK)
+            return rc;
+
+        if (tables.empty())
+            rc = sqlite3session_attach(*session, nullptr);
+
+        for (size_t i = 0; i < tables.size() && rc == SQLITE_OK; i++)
+            rc = sqlite3session_attach(*session, tables[i].c_str());
+
+        if (rc != SQLITE_OK)
+        {
+            sqlite3session_delete(*session);
+            *session = nullptr;
+        }
+        return rc;
+    }
+
+    static int OnConflict(void*, int conflict, sqlite3_changeset_iter*)
+    {
+        switch (conflict)
+        {
+        case SQLITE_CHANGESET_DATA:
+        case SQLITE_CHANGESET_CONFLICT:
+            return SQLITE_CHANGESET_REPLACE;
+        case SQLITE_CHANGESET_NOTFOUND:
+            return SQLITE_CHANGESET_OMIT;
+        default:
+            return SQLITE_CHANGESET_ABORT;
+        }
+    }
+
+    Session* CreateSession(sqlite3* db, const std::vector<std::string>& tables, std::string& error)
+    {
+        sqlite3_session* session = nullptr;
+        int              rc      = Attach(db, tables, &session);
+        if (rc != SQLITE_OK)
+        {
+            error = sqlite3_errstr(rc);
+            return nullptr;
+        }
+
+        auto* result = new Session { db, session, tables };
+        s_sessions.insert(result);
+        return result;
+    }
+
+    bool IsSession(Session* session)
+    {
+        return s_sessions.count(session) != 0;
+    }
+
+    bool GetChangeset(Session* session, bool reset, std::vector<uint8_t>& changeset, std::string& error)
+    {
+        int   size = 0;
+        void* data = nullptr;
+        int   rc   = sqlite3session_changeset(session->session, &size, &data);
+        if (rc != SQLITE_OK)
+        {
+            error = sqlite3_errstr(rc);
+            return false;
+        }
+
+        changeset.assign((uint8_t*)data, (uint8_t*)data + size);
+        sqlite3_free(data);
+
+        // a session can't be cleared, a new one only records what happens from now on
+        if (reset)
+        {
+            sqlite3_session* fresh = nullptr;
+            rc = Attach(session->db, session->tables, &fresh);
+            if (rc != SQLITE_OK)
+            {
+                error = sqlite3_errstr(rc);
+                return false;
+            }
+
+            sqlite3session_delete(session->session);
+            session->session = fresh;
+        }
+
+        return true;
+    }
+
+    void DeleteSession(Session* session)
+    {
+        if (!s_sessions.erase(session))
+            return;
+
+        sqlite3session_delete(session->session);
+        delete session;
+    }
+
+    void DeleteSessions(sqlite3* db)
+    {
+        for (auto it = s_sessions.begin(); it != s_sessions.end();)
+        {
+            Session* session = *it;
+            if (session->db != db)
+            {
+                it++;
+                continue;
+            }
+
+            it = s_sessions.erase(it);
+            sqlite3session_delete(session->session);
+            delete session;
+        }
+    }
+
+    bool ApplyChangeset(sqlite3* db, const std::vector<uint8_t>& changeset, std::string& error)
+    {
+        int rc = sqlite3changeset_apply(db, (int)changeset.size(), (void*)changeset.data(), nullptr, OnConflict, nullptr);
+        if (rc != SQLITE_OK)
+        {
+            error = sqlite3_errstr(rc);
+            return false;
+        }
+        return true;
+    }
+
+    bool InvertChangeset(const std::vector<uint8_t>& changeset, std::vector<uint8_t>& inverted)
+    {
+        int   size = 0;
+        void* data = nullptr;
+        if (sqlite3changeset_invert((int)changeset.size(), changeset.data(), &size, &data) != SQLITE_OK)
+            return false;
+
+        inverted.assign((uint8_t*)data, (uint8_t*)data + size);
+        sqlite3_free(data);
+        return true;
+    }
+} // namespace module
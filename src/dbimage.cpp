@@ -0,0 +1,129 @@
+#include "dbimage.hpp"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace module
+{
+    struct Image
+    {
+        std::string          path;
+        std::vector<uint8_t> data;
+        int                  connections;
+    };
+
+    // images by the full path of the file, and the image every open connection uses
+    static std::unordered_map<std::string, std::unique_ptr<Image>> s_images;
+    static std::unordered_map<sqlite3*, Image*>                    s_imageDatabases;
+
+    // offsets of the file format version numbers in the database header, 2 means WAL
+    constexpr int HEADER_WRITE_VERSION = 18;
+    constexpr int HEADER_READ_VERSION  = 19;
+
+    // reads the database through a connection instead of copying the file, so committed changes still in the -wal
+    // file (not checkpointed yet) are part of the image
+    static bool ReadDatabase(const std::string& path, std::vector<uint8_t>& data, std::string& error)
+    {
+        sqlite3* db = nullptr;
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(db);
+            sqlite3_close(db);
+            return false;
+        }
+
+        sqlite3_int64  size  = 0;
+        unsigned char* bytes = sqlite3_serialize(db, "main", &size, 0);
+        bool           ok    = bytes && size >= 100;
+        if (ok)
+            data.assign(bytes, bytes + size);
+        else
+            error = bytes ? "not a database file" : sqlite3_errmsg(db);
+
+        sqlite3_free(bytes);
+        sqlite3_close(db);
+        return ok;
+    }
+
+    static Image* LoadImage(const std::string& path, std::string& error)
+    {
+        // let the default VFS resolve the path so relative and absolute names share an image
+        sqlite3_vfs*      vfs = sqlite3_vfs_find(nullptr);
+        std::vector<char> fullPath(vfs->mxPathname + 1);
+        if (vfs->xFullPathname(vfs, path.c_str(), vfs->mxPathname + 1, fullPath.data()) != SQLITE_OK)
+        {
+            error = "invalid path";
+            return nullptr;
+        }
+
+        auto& image = s_images[fullPath.data()];
+        if (image)
+            return image.get();
+
+        image       = std::make_unique<Image>();
+        image->path = fullPath.data();
+        if (!ReadDatabase(image->path, image->data, error))
+        {
+            s_images.erase(fullPath.data());
+            return nullptr;
+        }
+
+        // a copy of a WAL database is opened like a rollback one, memdb can't do WAL
+        if (image->data[HEADER_WRITE_VERSION] == 2)
+            image->data[HEADER_WRITE_VERSION] = image->data[HEADER_READ_VERSION] = 1;
+
+        image->connections = 0;
+        return image.get();
+    }
+
+    static void ReleaseImage(Image* image)
+    {
+        if (--image->connections == 0)
+            s_images.erase(image->path);
+    }
+
+    bool OpenImage(const std::string& path, sqlite3** db, std::string& error)
+    {
+        Image* image = LoadImage(path, error);
+        if (!image)
+            return false;
+
+        image->connections++;
+
+        // SQLite doesn't own the buffer (no SQLITE_DESERIALIZE_FREEONCLOSE), it can be used by any number of
+        // connections as none of them is allowed to write to it
+        int rc = sqlite3_open_v2(":memory:", db, SQLITE_OPEN_READWRITE, nullptr);
+        if (rc == SQLITE_OK)
+            rc = sqlite3_deserialize(*db, "main", image->data.data(), image->data.size(), image->data.size(), SQLITE_DESERIALIZE_READONLY);
+
+        if (rc != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(*db);
+            sqlite3_close(*db);
+            ReleaseImage(image);
+            return false;
+        }
+
+        s_imageDatabases[*db] = image;
+        return true;
+    }
+
+    bool CloseImage(sqlite3* db)
+    {
+        auto it = s_imageDatabases.find(db);
+        if (it == s_imageDatabases.end())
+            return false;
+
+        Image* image = it->second;
+        s_imageDatabases.erase(it);
+
+        // with unfinalized statements the connection lives on as a zombie still reading the image, keep it then
+        if (sqlite3_close(db) == SQLITE_OK)
+            ReleaseImage(image);
+        else
+            sqlite3_close_v2(db);
+
+        return true;
+    }
+} // namespace module
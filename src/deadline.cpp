@@ -0,0 +1,144 @@
+#include "deadline.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+namespace module
+{
+    using Clock = std::chrono::steady_clock;
+
+    // virtual machine instructions between two checks of the clock
+    constexpr int DEADLINE_CHECK_INTERVAL = 1000;
+
+    struct Deadline
+    {
+        int               timeoutMs;
+        Clock::time_point until;
+
+        // set when the progress handler stopped a statement
+        bool interrupted;
+
+        // flag of the innermost scope that can be cancelled
+        const std::atomic<bool>* cancelled;
+    };
+
+    static std::mutex                              s_deadlinesMutex;
+    static std::unordered_map<sqlite3*, Deadline*> s_deadlines;
+
+    static int OnProgress(void* arg)
+    {
+        auto* deadline = (Deadline*)arg;
+        if (deadline->cancelled && *deadline->cancelled)
+            return 1;
+        if (Clock::now() <= deadline->until)
+            return 0;
+
+        deadline->interrupted = true;
+        return 1;
+    }
+
+    static Deadline* FindDeadline(sqlite3* db)
+    {
+        std::lock_guard<std::mutex> lock(s_deadlinesMutex);
+
+        auto it = s_deadlines.find(db);
+        return it != s_deadlines.end() ? it->second : nullptr;
+    }
+
+    void EnableDeadlines(sqlite3* db)
+    {
+        auto* deadline = new Deadline { 0, Clock::time_point::max(), false, nullptr };
+        {
+            std::lock_guard<std::mutex> lock(s_deadlinesMutex);
+            s_deadlines[db] = deadline;
+        }
+
+        sqlite3_progress_handler(db, DEADLINE_CHECK_INTERVAL, OnProgress, deadline);
+    }
+
+    void DisableDeadlines(sqlite3* db)
+    {
+        Deadline* deadline = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(s_deadlinesMutex);
+
+            auto it = s_deadlines.find(db);
+            if (it == s_deadlines.end())
+                return;
+
+            deadline = it->second;
+            s_deadlines.erase(it);
+        }
+
+        sqlite3_progress_handler(db, 0, nullptr, nullptr);
+        delete deadline;
+    }
+
+    void SetDefaultTimeout(sqlite3* db, int timeoutMs)
+    {
+        if (Deadline* deadline = FindDeadline(db))
+            deadline->timeoutMs = timeoutMs;
+    }
+
+    int GetDefaultTimeout(sqlite3* db)
+    {
+        Deadline* deadline = FindDeadline(db);
+        return deadline ? deadline->timeoutMs : 0;
+    }
+
+    Clock::time_point GetDeadline(sqlite3* db)
+    {
+        Deadline* deadline = FindDeadline(db);
+        return deadline ? deadline->until : Clock::time_point::max();
+    }
+
+    DeadlineScope::DeadlineScope(sqlite3* db, int timeoutMs)
+        : m_deadline(FindDeadline(db))
+    {
+        if (!m_deadline)
+            return;
+
+        m_previous              = m_deadline->until;
+        m_previousInterrupted   = m_deadline->interrupted;
+        m_previousCancelled     = m_deadline->cancelled;
+        m_deadline->interrupted = false;
+
+        if (timeoutMs < 0)
+            timeoutMs = m_deadline->timeoutMs;
+
+        // a nested scope can only shorten the deadline it runs in
+        if (timeoutMs > 0)
+            m_deadline->until = std::min(m_previous, Clock::now() + std::chrono::milliseconds(timeoutMs));
+    }
+
+    DeadlineScope::DeadlineScope(sqlite3* db, Clock::time_point until, const std::atomic<bool>* cancelled)
+        : m_deadline(FindDeadline(db))
+    {
+        if (!m_deadline)
+            return;
+
+        m_previous              = m_deadline->until;
+        m_previousInterrupted   = m_deadline->interrupted;
+        m_previousCancelled     = m_deadline->cancelled;
+        m_deadline->until       = std::min(m_previous, until);
+        m_deadline->interrupted = false;
+        if (cancelled)
+            m_deadline->cancelled = cancelled;
+    }
+
+    DeadlineScope::~DeadlineScope()
+    {
+        if (!m_deadline)
+            return;
+
+        m_deadline->until       = m_previous;
+        m_deadline->interrupted = m_previousInterrupted;
+        m_deadline->cancelled   = m_previousCancelled;
+    }
+
+    bool DeadlineScope::Interrupted() const
+    {
+        return m_deadline && m_deadline->interrupted;
+    }
+} // namespace module
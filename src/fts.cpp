@@ -0,0 +1,83 @@
+#include "fts.hpp"
+
+#include "sqlutil.hpp"
+
+namespace module
+{
+    static std::string JoinColumns(const std::string& prefix, const std::vector<std::string>& columns)
+    {
+        std::string result;
+        for (auto& column : columns)
+            result += (result.empty() ? "" : ", ") + prefix + QuoteIdentifier(column);
+        return result;
+    }
+
+    std::string GetFtsIndexName(const std::string& table)
+    {
+        return table + "_fts";
+    }
+
+    int CreateFtsIndex(sqlite3* db, const std::string& table, const std::vector<std::string>& columns, std::string& error)
+    {
+        // search() resolves snippet columns by their position, so an existing index has to have the same ones
+        std::string index = GetFtsIndexName(table);
+        if (TableExists(db, index))
+        {
+            std::vector<std::string> existing = GetTableColumns(db, index);
+            if (existing == columns)
+                return SQLITE_OK;
+
+            error = index + " already exists with the columns (" + JoinColumns("", existing) + ")";
+            return SQLITE_ERROR;
+        }
+
+        if (columns.empty())
+        {
+            error = "no columns given";
+            return SQLITE_MISUSE;
+        }
+
+        std::string idx = QuoteIdentifier(index);
+        std::string tbl = QuoteIdentifier(table);
+        std::string cols = JoinColumns("", columns);
+
+        char* options = sqlite3_mprintf("content=%Q, content_rowid='rowid'", table.c_str());
+
+        // savepoint instead of BEGIN so it also works inside a transaction of the caller
+        std::string sql = "SAVEPOINT fts_index;"
+                          "CREATE VIRTUAL TABLE " + idx + " USING fts5(" + cols + ", " + options + ");"
+                          "INSERT INTO " + idx + "(" + idx + ") VALUES ('rebuild');"
+                          "CREATE TRIGGER " + QuoteIdentifier(index + "_insert") + " AFTER INSERT ON " + tbl + " BEGIN "
+                          "INSERT INTO " + idx + "(rowid, " + cols + ") VALUES (NEW.rowid, " + JoinColumns("NEW.", columns) + "); END;"
+                          "CREATE TRIGGER " + QuoteIdentifier(index + "_delete") + " AFTER DELETE ON " + tbl + " BEGIN "
+                          "INSERT INTO " + idx + "(" + idx + ", rowid, " + cols + ") VALUES ('delete', OLD.rowid, " + JoinColumns("OLD.", columns) + "); END;"
+                          "CREATE TRIGGER " + QuoteIdentifier(index + "_update") + " AFTER UPDATE ON " + tbl + " BEGIN "
+                          "INSERT INTO " + idx + "(" + idx + ", rowid, " + cols + ") VALUES ('delete', OLD.rowid, " + JoinColumns("OLD.", columns) + ");"
+                          "INSERT INTO " + idx + "(rowid, " + cols + ") VALUES (NEW.rowid, " + JoinColumns("NEW.", columns) + "); END;"
+                          "RELEASE fts_index;";
+
+        sqlite3_free(options);
+
+        int ret = sqlite3_exec(db, sql.c_str(), 0, 0, 0);
+        if (ret != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(db);
+            sqlite3_exec(db, "ROLLBACK TO fts_index; RELEASE fts_index;", 0, 0, 0);
+        }
+
+        return ret;
+    }
+
+    std::string GetFtsQuery(const std::string& table, int snippetColumn)
+    {
+        // auxiliary functions need the table name itself, an alias doesn't work
+        std::string idx = QuoteIdentifier(GetFtsIndexName(table));
+
+        std::string sql = "SELECT t.*, bm25(" + idx + ") AS rank";
+        if (snippetColumn >= -1)
+            sql += ", snippet(" + idx + ", " + std::to_string(snippetColumn) + ", '[', ']', '...', 16) AS snippet";
+
+        // bm25 is lower for better matches
+        return sql + " FROM " + idx + " JOIN " + QuoteIdentifier(table) + " t ON t.rowid = " + idx + ".rowid WHERE " + idx + " MATCH ?1 ORDER BY rank LIMIT ?2";
+    }
+} // namespace module
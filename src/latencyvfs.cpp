@@ -0,0 +1,154 @@
+#include "latencyvfs.hpp"
+
+#include "vfsshim.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+namespace module
+{
+    using Clock = std::chrono::steady_clock;
+
+    static LatencyConfig         s_latencyConfig;
+    static std::atomic<uint32_t> s_syncCount;
+
+    // only touched on the main thread
+    static std::thread::id s_mainThread;
+    static uint64_t        s_pulseUs;
+    static LatencyStats    s_latencyStats;
+
+    static sqlite3_vfs        s_latencyVfs;
+    static sqlite3_io_methods s_latencyIoMethods;
+
+    static void Delay(uint32_t us)
+    {
+        if (s_latencyConfig.jitterUs)
+        {
+            thread_local std::minstd_rand random(std::random_device {}());
+            us += random() % (s_latencyConfig.jitterUs + 1);
+        }
+
+        if (us)
+            std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    // adds the time of a VFS call, delay included, to the pulse when it's made on the main thread
+    class PulseTimer
+    {
+    public:
+        PulseTimer()
+            : m_start(std::this_thread::get_id() == s_mainThread ? Clock::now() : Clock::time_point {})
+        {
+        }
+
+        ~PulseTimer()
+        {
+            if (m_start != Clock::time_point {})
+                s_pulseUs += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - m_start).count();
+        }
+
+    private:
+        Clock::time_point m_start;
+    };
+
+    static int LatencyRead(sqlite3_file* file, void* data, int amount, sqlite3_int64 offset)
+    {
+        PulseTimer timer;
+        Delay(s_latencyConfig.readUs);
+        return GetRealFile(file)->pMethods->xRead(GetRealFile(file), data, amount, offset);
+    }
+
+    static int LatencyWrite(sqlite3_file* file, const void* data, int amount, sqlite3_int64 offset)
+    {
+        PulseTimer timer;
+        Delay(s_latencyConfig.writeUs);
+        return GetRealFile(file)->pMethods->xWrite(GetRealFile(file), data, amount, offset);
+    }
+
+    static int LatencyLock(sqlite3_file* file, int lock)
+    {
+        PulseTimer timer;
+        Delay(s_latencyConfig.lockUs);
+        return GetRealFile(file)->pMethods->xLock(GetRealFile(file), lock);
+    }
+
+    static int LatencyUnlock(sqlite3_file* file, int lock)
+    {
+        PulseTimer timer;
+        Delay(s_latencyConfig.lockUs);
+        return GetRealFile(file)->pMethods->xUnlock(GetRealFile(file), lock);
+    }
+
+    static int LatencyCheckReservedLock(sqlite3_file* file, int* result)
+    {
+        PulseTimer timer;
+        Delay(s_latencyConfig.lockUs);
+        return GetRealFile(file)->pMethods->xCheckReservedLock(GetRealFile(file), result);
+    }
+
+    static int LatencyShmLock(sqlite3_file* file, int offset, int n, int flags)
+    {
+        PulseTimer timer;
+        Delay(s_latencyConfig.lockUs);
+        return GetRealFile(file)->pMethods->xShmLock(GetRealFile(file), offset, n, flags);
+    }
+
+    static int LatencySync(sqlite3_file* file, int flags)
+    {
+        PulseTimer timer;
+        Delay(s_latencyConfig.syncUs);
+
+        if (s_latencyConfig.stallEvery && ++s_syncCount % s_latencyConfig.stallEvery == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(s_latencyConfig.stallMs));
+
+        return GetRealFile(file)->pMethods->xSync(GetRealFile(file), flags);
+    }
+
+    static int LatencyOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags)
+    {
+        return OpenShimFile(vfs, name, file, flags, outFlags, &s_latencyIoMethods);
+    }
+
+    void RegisterLatencyVfs(const LatencyConfig& config)
+    {
+        s_latencyConfig = config;
+        s_mainThread    = std::this_thread::get_id();
+
+        s_latencyIoMethods                    = GetShimIoMethods();
+        s_latencyIoMethods.xRead              = LatencyRead;
+        s_latencyIoMethods.xWrite             = LatencyWrite;
+        s_latencyIoMethods.xSync              = LatencySync;
+        s_latencyIoMethods.xLock              = LatencyLock;
+        s_latencyIoMethods.xUnlock            = LatencyUnlock;
+        s_latencyIoMethods.xCheckReservedLock = LatencyCheckReservedLock;
+        s_latencyIoMethods.xShmLock           = LatencyShmLock;
+
+        InitShimVfs(&s_latencyVfs, sqlite3_vfs_find(nullptr), "latency", sizeof(ShimFile), LatencyOpen);
+        sqlite3_vfs_register(&s_latencyVfs, 0);
+    }
+
+    void EndLatencyPulse()
+    {
+        uint64_t ms     = s_pulseUs / 1000;
+        int      bucket = 0;
+        while (bucket < LATENCY_HISTOGRAM_BUCKETS - 1 && ms >= (1ull << bucket))
+            bucket++;
+
+        s_latencyStats.pulses++;
+        s_latencyStats.histogram[bucket]++;
+        s_latencyStats.totalUs += s_pulseUs;
+        if (s_pulseUs > s_latencyStats.maxUs)
+            s_latencyStats.maxUs = s_pulseUs;
+
+        s_pulseUs = 0;
+    }
+
+    void GetLatencyStats(LatencyStats& stats, bool reset)
+    {
+        stats = s_latencyStats;
+        if (reset)
+            s_latencyStats = LatencyStats {};
+    }
+} // namespace module
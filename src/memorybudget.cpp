@@ -0,0 +1,124 @@
+#include "memorybudget.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+
+namespace module
+{
+    constexpr auto REBALANCE_INTERVAL = std::chrono::seconds(1);
+
+    // share of the budget SQLite may use on an empty and on a full server
+    constexpr double BUDGET_SHARE_QUIET = 1.0;
+    constexpr double BUDGET_SHARE_FULL  = 0.5;
+
+    // of that share, how much goes to page caches (the rest is left for statements, schemas, sorting...)
+    constexpr double CACHE_SHARE = 0.5;
+
+    // cache sizes are only touched again when they'd change by more than this, resizing throws pages away
+    constexpr double CACHE_RESIZE_THRESHOLD = 0.1;
+
+    struct TrackedDatabase
+    {
+        // cache size in KiB as last set
+        sqlite3_int64 cacheKiB;
+
+        // sum of the cache counters at the last rebalance, unchanged means the connection was idle
+        int activity;
+    };
+
+    static sqlite3_int64                                 s_budget;
+    static std::unordered_map<sqlite3*, TrackedDatabase> s_databases;
+
+    static std::chrono::steady_clock::time_point s_lastRebalance;
+
+    void SetMemoryBudget(sqlite3_int64 bytes)
+    {
+        s_budget = bytes;
+        sqlite3_hard_heap_limit64(bytes);
+        sqlite3_soft_heap_limit64(bytes);
+    }
+
+    sqlite3_int64 GetMemoryBudget()
+    {
+        return s_budget;
+    }
+
+    void TrackDatabase(sqlite3* db)
+    {
+        if (s_budget > 0)
+            s_databases[db] = { 0, -1 };
+    }
+
+    void UntrackDatabase(sqlite3* db)
+    {
+        s_databases.erase(db);
+    }
+
+    static int GetActivity(sqlite3* db)
+    {
+        int activity = 0;
+        for (int op : { SQLITE_DBSTATUS_CACHE_HIT, SQLITE_DBSTATUS_CACHE_MISS, SQLITE_DBSTATUS_CACHE_WRITE })
+        {
+            int current   = 0;
+            int highwater = 0;
+            sqlite3_db_status(db, op, &current, &highwater, 0);
+            activity += current;
+        }
+        return activity;
+    }
+
+    static bool IsIdle(sqlite3* db, TrackedDatabase& tracked)
+    {
+        int  activity    = GetActivity(db);
+        bool idle        = activity == tracked.activity;
+        tracked.activity = activity;
+
+        // a statement that is still stepping keeps its pages even if it hasn't read anything since the last check
+        for (sqlite3_stmt* stmt = sqlite3_next_stmt(db, nullptr); stmt && idle; stmt = sqlite3_next_stmt(db, stmt))
+            idle = !sqlite3_stmt_busy(stmt);
+
+        return idle;
+    }
+
+    void RebalanceMemory(int players, int maxPlayers)
+    {
+        if (s_budget <= 0)
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - s_lastRebalance < REBALANCE_INTERVAL)
+            return;
+        s_lastRebalance = now;
+
+        double load  = maxPlayers > 0 ? std::min(1.0, (double)players / maxPlayers) : 0.0;
+        double share = BUDGET_SHARE_QUIET + (BUDGET_SHARE_FULL - BUDGET_SHARE_QUIET) * load;
+
+        sqlite3_int64 softLimit = (sqlite3_int64)(s_budget * share);
+        sqlite3_soft_heap_limit64(softLimit);
+
+        if (s_databases.empty())
+            return;
+
+        sqlite3_int64 cacheKiB = (sqlite3_int64)(softLimit * CACHE_SHARE / s_databases.size() / 1024);
+        bool          pressure = sqlite3_memory_used() > softLimit;
+
+        for (auto& [db, tracked] : s_databases)
+        {
+            bool idle = IsIdle(db, tracked);
+
+            if (std::llabs(cacheKiB - tracked.cacheKiB) > tracked.cacheKiB * CACHE_RESIZE_THRESHOLD)
+            {
+                // negative cache_size is in KiB instead of pages
+                std::string pragma = "PRAGMA cache_size = -" + std::to_string(cacheKiB);
+                sqlite3_exec(db, pragma.c_str(), nullptr, nullptr, nullptr);
+                tracked.cacheKiB = cacheKiB;
+            }
+
+            if (pressure && idle)
+                sqlite3_db_release_memory(db);
+        }
+    }
+} // namespace module
@@ -1,181 +1,2625 @@
 #include "module.hpp"
 
+#include "allocator.hpp"
+#include "backup.hpp"
+#include "blobtypes.hpp"
+#include "busy.hpp"
+#include "changeset.hpp"
+#include "dbimage.hpp"
+#include "deadline.hpp"
+#include "fts.hpp"
+#ifdef SQLMODULE_LATENCY_VFS
+    #include "latencyvfs.hpp"
+#endif
+#include "memorybudget.hpp"
+#include "servertables.hpp"
+#include "spatial.hpp"
+#include "statsvfs.hpp"
+#include "uringvfs.hpp"
+#include "workerpool.hpp"
+
 #include <sqlite/sqlite3.h>
 
-namespace module
-{
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace module
+{
+    // integers outside of +-2^53 can't be represented exactly by a script number
+    constexpr sqlite3_int64 MAX_SAFE_INTEGER = 9007199254740992LL;
+
+    enum class Int64Mode
+    {
+        String,
+        Number
+    };
+
+    Int64Mode m_int64Mode = Int64Mode::String;
+
+    // lookaside slot size and count of every connection, SQLite's defaults when 0
+    uint32_t m_lookasideSize  = 0;
+    uint32_t m_lookasideCount = 0;
+
+    // time spent copying snapshots and backups per pulse
+    uint32_t m_backupSliceUs = 1000;
+
+    // a backup fails once another connection made it start over this often, unless the script sets maxRestarts
+    constexpr int BACKUP_MAX_RESTARTS = 100;
+
+    // connections opened by scripts and not closed yet, used to validate SqlDatabase objects passed as arguments
+    std::unordered_set<sqlite3*> m_databases;
+
+    using Buffer = std::vector<uint8_t>;
+
+    // buffers handed out to scripts, used to validate the internal pointer of SqlBuffer objects
+    std::unordered_set<Buffer*> m_buffers;
+
+    constexpr uint32_t SLICED_QUERY_US = 1000;
+
+    // longest a sliced query may stay open, its read transaction keeps WAL checkpoints from finishing
+    uint32_t m_slicedMaxMs = 60000;
+
+    // time all sliced queries together may take per pulse, and the rotation of who goes first when it runs out
+    uint32_t m_slicedPulseUs = 2000;
+    size_t   m_slicedOffset  = 0;
+
+    // statement stepped for at most sliceUs every pulse, rows are kept in the binary result format until it's done
+    struct SlicedQuery
+    {
+        sqlite3*      db;
+        sqlite3_stmt* stmt;
+        uint32_t      sliceUs;
+        Buffer        rows;
+        String        error;
+
+        // the query fails once it's still running after this, summed over all pulses
+        std::chrono::steady_clock::time_point until;
+    };
+
+    // queries handed out to scripts, used to validate the internal pointer of SqlSlicedQuery objects
+    std::unordered_set<SlicedQuery*> m_slicedQueries;
+
+    // read-only connections async queries run on, so a worker never holds the connection the script uses
+    struct ConnectionPool
+    {
+        String filename;
+        String vfs;
+
+        std::mutex            mutex;
+        std::vector<sqlite3*> idle;
+
+        // queries submitted and not finished yet, the pool is deleted once it's closed and none are left
+        int  users;
+        bool closed;
+    };
+
+    // pools of the open databases by their main connection, only used on the main thread
+    std::unordered_map<sqlite3*, ConnectionPool*> m_connectionPools;
+
+    // statement run to completion on a pool connection by a worker thread, rows are kept in the binary result format
+    // like sliced queries
+    struct AsyncQuery
+    {
+        sqlite3*                    db;
+        ConnectionPool*             pool;
+        String                      sql;
+        std::vector<sqlite3_value*> params;
+        Buffer                      rows;
+        String                      error;
+        JobId                       job;
+
+        // measured from submitting, so time spent in the queue counts too
+        std::chrono::steady_clock::time_point until;
+
+        // set by the main thread, the worker stops at its next progress check and reports cancelReason as error
+        std::atomic<bool> cancelled;
+        String            cancelReason;
+
+        // rows and error may only be read once this is set
+        std::atomic<bool> done;
+
+        // held by the script handle and the job, whichever lets go last deletes the query
+        std::atomic<int> references;
+    };
+
+    // queries handed out to scripts, used to validate the internal pointer of SqlAsyncQuery objects
+    std::unordered_set<AsyncQuery*> m_asyncQueries;
+
+    // resource ids of the script VMs, numbered in the order they registered the functions
+    std::unordered_map<Scripting::API::IVM*, ResourceId> m_resourceIds;
+
+    // value tags of the binary result format, see WriteBinaryColumn
+    enum BinaryTag : uint8_t
+    {
+        BINARY_NULL    = 0,
+        BINARY_INTEGER = 1,
+        BINARY_FLOAT   = 2,
+        BINARY_TEXT    = 3,
+        BINARY_BLOB    = 4
+    };
+
+    constexpr uint8_t BINARY_MAGIC[]  = { 'S', 'Q', 'L', 'B' };
+    constexpr uint8_t BINARY_VERSION = 2;
+
+    static const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    static bool IsSafeInteger(sqlite3_int64 value)
+    {
+        return value >= -MAX_SAFE_INTEGER && value <= MAX_SAFE_INTEGER;
+    }
+
+    static void SetInteger(Scripting::API::IObject& obj, const String& key, sqlite3_int64 value)
+    {
+        if (value >= INT32_MIN && value <= INT32_MAX)
+            obj.Set(key, (int)value);
+        else if (IsSafeInteger(value) || m_int64Mode == Int64Mode::Number)
+            obj.Set(key, (double)value);
+        else
+            obj.Set(key, std::to_string(value));
+    }
+
+    static const char* const MATRIX4X4_FIELDS[16] = { "rx", "ry", "rz", "rw", "fx", "fy", "fz", "fw", "ux", "uy", "uz", "uw", "px", "py", "pz", "pw" };
+
+    static void SetBlob(Scripting::API::ICallbackInfo& info, Scripting::API::IObject& obj, const String& key, BlobType type, const void* data)
+    {
+        switch (type)
+        {
+        case BlobType::Vector2:
+        {
+            auto  vec    = UnpackVector2(data);
+            auto& objVec = info.ObjectValue("Vector2", nullptr);
+            objVec.Set("x", (double)vec.x);
+            objVec.Set("y", (double)vec.y);
+            obj.Set(key, objVec);
+            break;
+        }
+        case BlobType::Vector3:
+        {
+            auto  vec    = UnpackVector3(data);
+            auto& objVec = info.ObjectValue("Vector3", nullptr);
+            objVec.Set("x", (double)vec.x);
+            objVec.Set("y", (double)vec.y);
+            objVec.Set("z", (double)vec.z);
+            obj.Set(key, objVec);
+            break;
+        }
+        case BlobType::RGBA:
+        {
+            auto  color    = UnpackRGBA(data);
+            auto& objColor = info.ObjectValue("RGBA", nullptr);
+            objColor.Set("r", (int)color.r);
+            objColor.Set("g", (int)color.g);
+            objColor.Set("b", (int)color.b);
+            objColor.Set("a", (int)color.a);
+            obj.Set(key, objColor);
+            break;
+        }
+        case BlobType::Matrix4x4:
+        {
+            auto  matrix    = UnpackMatrix4x4(data);
+            auto& objMatrix = info.ObjectValue("Matrix4x4", nullptr);
+            for (int i = 0; i < 16; i++)
+                objMatrix.Set(MATRIX4X4_FIELDS[i], (double)matrix.f[i / 4][i % 4]);
+            obj.Set(key, objMatrix);
+            break;
+        }
+        default:
+            // not supported, set it to null
+            obj.SetNull(key);
+            break;
+        }
+    }
+
+    static void SetColumn(Scripting::API::ICallbackInfo& info, Scripting::API::IObject& obj, const String& key, sqlite3_stmt* stmt, int col)
+    {
+        switch (sqlite3_column_type(stmt, col))
+        {
+        case SQLITE_INTEGER:
+            SetInteger(obj, key, sqlite3_column_int64(stmt, col));
+            break;
+        case SQLITE_FLOAT:
+            obj.Set(key, sqlite3_column_double(stmt, col));
+            break;
+        case SQLITE_BLOB:
+        {
+            const void* data = sqlite3_column_blob(stmt, col);
+            SetBlob(info, obj, key, GetBlobType(sqlite3_column_decltype(stmt, col), sqlite3_column_bytes(stmt, col)), data);
+            break;
+        }
+        case SQLITE3_TEXT:
+            obj.Set(key, String { reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)), (size_t)sqlite3_column_bytes(stmt, col) });
+            break;
+        case SQLITE_NULL:
+            obj.SetNull(key);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // strings holding an integer that doesn't fit a script number (as returned by SetColumn) are bound back as integers
+    static bool ParseUnsafeInteger(const String& str, sqlite3_int64& value)
+    {
+        if (str.empty() || str.size() > 20)
+            return false;
+
+        char* end;
+        errno = 0;
+        value = std::strtoll(str.c_str(), &end, 10);
+        return errno == 0 && *end == '\0' && !IsSafeInteger(value) && std::to_string(value) == str;
+    }
+
+    static bool HasNumbers(Scripting::API::IObject& obj, const char* const* fields, int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (!obj.Get(fields[i]).IsNumber())
+                return false;
+        }
+        return true;
+    }
+
+    // objects shaped like the math types ({ x, y, z }, { r, g, b, a }, { rx, ..., pw }) are bound as their blob layout,
+    // only with every field of the type a number; anything else is bound as NULL like other objects
+    static int BindObject(sqlite3_stmt* stmt, int index, Scripting::API::IObject& obj)
+    {
+        static const char* const RGBA_FIELDS[]   = { "r", "g", "b", "a" };
+        static const char* const VECTOR_FIELDS[] = { "x", "y", "z" };
+
+        uint8_t  blob[MATRIX4X4_SIZE];
+        BlobType type = BlobType::None;
+
+        if (HasNumbers(obj, MATRIX4X4_FIELDS, 16))
+        {
+            Math::Matrix4x4 matrix;
+            for (int i = 0; i < 16; i++)
+                matrix.f[i / 4][i % 4] = (float)obj.Get(MATRIX4X4_FIELDS[i]).ToNumber();
+
+            PackMatrix4x4(blob, matrix);
+            type = BlobType::Matrix4x4;
+        }
+        else if (HasNumbers(obj, RGBA_FIELDS, 4))
+        {
+            auto channel = [&obj](const char* name) {
+                double value = obj.Get(name).ToNumber();
+
+                // NaN passes through clamp and converting it is undefined
+                return std::isnan(value) ? (uint8_t)0 : (uint8_t)std::clamp(value, 0.0, 255.0);
+            };
+
+            PackRGBA(blob, Math::RGBA(channel("r"), channel("g"), channel("b"), channel("a")));
+            type = BlobType::RGBA;
+        }
+        else if (HasNumbers(obj, VECTOR_FIELDS, 2))
+        {
+            float x = (float)obj.Get("x").ToNumber();
+            float y = (float)obj.Get("y").ToNumber();
+
+            if (HasNumbers(obj, VECTOR_FIELDS + 2, 1))
+            {
+                PackVector3(blob, Math::Vector3(x, y, (float)obj.Get("z").ToNumber()));
+                type = BlobType::Vector3;
+            }
+            else
+            {
+                PackVector2(blob, Math::Vector2(x, y));
+                type = BlobType::Vector2;
+            }
+        }
+
+        if (type == BlobType::None)
+            return sqlite3_bind_null(stmt, index);
+
+        return sqlite3_bind_blob(stmt, index, blob, GetBlobSize(type), SQLITE_TRANSIENT);
+    }
+
+    static int BindValue(sqlite3_stmt* stmt, int index, Scripting::API::IValue& value)
+    {
+        if (value.IsNumber())
+        {
+            double number = value.ToNumber();
+            if (std::trunc(number) == number && number >= -9223372036854775808.0 && number < 9223372036854775808.0)
+                return sqlite3_bind_int64(stmt, index, (sqlite3_int64)number);
+
+            return sqlite3_bind_double(stmt, index, number);
+        }
+
+        if (value.IsBoolean())
+            return sqlite3_bind_int(stmt, index, value.ToBoolean() ? 1 : 0);
+
+        if (value.IsString())
+        {
+            String        str = value.ToString();
+            sqlite3_int64 integer;
+            if (ParseUnsafeInteger(str, integer))
+                return sqlite3_bind_int64(stmt, index, integer);
+
+            return sqlite3_bind_text(stmt, index, str.c_str(), (int)str.size(), SQLITE_TRANSIENT);
+        }
+
+        if (value.IsObject())
+        {
+            // SqlBuffer and SqlChangeset objects are stored as their bytes
+            Buffer* buffer = (Buffer*)value.ToObject().GetInternal();
+            if (m_buffers.count(buffer))
+                return sqlite3_bind_blob(stmt, index, buffer->data(), (int)buffer->size(), SQLITE_TRANSIENT);
+
+            return BindObject(stmt, index, value.ToObject());
+        }
+
+        return sqlite3_bind_null(stmt, index);
+    }
+
+    // positional parameters are looked up by their zero based index, named ones (:name, @name, $name) by name
+    static int BindParams(sqlite3_stmt* stmt, Scripting::API::IObject& params)
+    {
+        int count = sqlite3_bind_parameter_count(stmt);
+        for (int i = 1; i <= count; i++)
+        {
+            const char* name = sqlite3_bind_parameter_name(stmt, i);
+            String      key  = name && name[0] != '?' ? String { name + 1 } : std::to_string(i - 1);
+
+            int ret = BindValue(stmt, i, params.Get(key));
+            if (ret != SQLITE_OK)
+                return ret;
+        }
+
+        return SQLITE_OK;
+    }
+
+    static void AppendJSONString(String& out, const char* str, size_t length)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        out += '"';
+
+        size_t start = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            unsigned char c = (unsigned char)str[i];
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+
+            out.append(str + start, i - start);
+            start = i + 1;
+
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+                break;
+            }
+        }
+
+        out.append(str + start, length - start);
+        out += '"';
+    }
+
+    static void AppendJSONField(String& out, const char* name, float value, bool first)
+    {
+        char buffer[32];
+
+        out += first ? "{\"" : ",\"";
+        out += name;
+        out += "\":";
+        if (std::isfinite(value))
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+        else
+            out += "null";
+    }
+
+    static void AppendJSONBlob(String& out, BlobType type, const void* data)
+    {
+        switch (type)
+        {
+        case BlobType::Vector2:
+        {
+            auto vec = UnpackVector2(data);
+            AppendJSONField(out, "x", vec.x, true);
+            AppendJSONField(out, "y", vec.y, false);
+            out += '}';
+            break;
+        }
+        case BlobType::Vector3:
+        {
+            auto vec = UnpackVector3(data);
+            AppendJSONField(out, "x", vec.x, true);
+            AppendJSONField(out, "y", vec.y, false);
+            AppendJSONField(out, "z", vec.z, false);
+            out += '}';
+            break;
+        }
+        case BlobType::RGBA:
+        {
+            auto color = UnpackRGBA(data);
+            out += "{\"r\":" + std::to_string(color.r) + ",\"g\":" + std::to_string(color.g) + ",\"b\":" + std::to_string(color.b) + ",\"a\":" + std::to_string(color.a) + '}';
+            break;
+        }
+        case BlobType::Matrix4x4:
+        {
+            auto matrix = UnpackMatrix4x4(data);
+            for (int i = 0; i < 16; i++)
+                AppendJSONField(out, MATRIX4X4_FIELDS[i], matrix.f[i / 4][i % 4], i == 0);
+            out += '}';
+            break;
+        }
+        default:
+            // other blobs are not supported, same as query
+            out += "null";
+            break;
+        }
+    }
+
+    static void AppendJSONColumn(String& out, sqlite3_stmt* stmt, int col)
+    {
+        char buffer[32];
+
+        switch (sqlite3_column_type(stmt, col))
+        {
+        case SQLITE_INTEGER:
+        {
+            sqlite3_int64 value = sqlite3_column_int64(stmt, col);
+            char*         end   = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+            if (IsSafeInteger(value) || m_int64Mode == Int64Mode::Number)
+                out.append(buffer, end);
+            else
+                AppendJSONString(out, buffer, end - buffer);
+            break;
+        }
+        case SQLITE_FLOAT:
+        {
+            double value = sqlite3_column_double(stmt, col);
+            if (std::isfinite(value))
+                out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+            else
+                out += "null";
+            break;
+        }
+        case SQLITE3_TEXT:
+            AppendJSONString(out, reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)), sqlite3_column_bytes(stmt, col));
+            break;
+        case SQLITE_BLOB:
+        {
+            const void* data = sqlite3_column_blob(stmt, col);
+            AppendJSONBlob(out, GetBlobType(sqlite3_column_decltype(stmt, col), sqlite3_column_bytes(stmt, col)), data);
+            break;
+        }
+        default:
+            out += "null";
+            break;
+        }
+    }
+
+    static void WriteVarint(Buffer& out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+    }
+
+    static bool ReadVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; data < end && shift < 64; shift += 7)
+        {
+            uint8_t byte = *data++;
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    static void WriteBytes(Buffer& out, const void* data, size_t length)
+    {
+        WriteVarint(out, length);
+        out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + length);
+    }
+
+    static String EncodeBase64(const Buffer& buffer)
+    {
+        String out;
+        out.reserve((buffer.size() + 2) / 3 * 4);
+        for (size_t i = 0; i < buffer.size(); i += 3)
+        {
+            uint32_t bits  = (uint32_t)buffer[i] << 16;
+            size_t   count = std::min(buffer.size() - i, (size_t)3);
+            if (count > 1)
+                bits |= (uint32_t)buffer[i + 1] << 8;
+            if (count > 2)
+                bits |= buffer[i + 2];
+
+            for (size_t j = 0; j < 4; j++)
+                out.push_back(j <= count ? BASE64_CHARS[(bits >> (18 - j * 6)) & 0x3F] : '=');
+        }
+        return out;
+    }
+
+    static bool DecodeBase64(const String& str, Buffer& out)
+    {
+        if (str.size() % 4)
+            return false;
+
+        out.reserve(str.size() / 4 * 3);
+        for (size_t i = 0; i < str.size(); i += 4)
+        {
+            uint32_t bits    = 0;
+            int      padding = 0;
+            for (size_t j = 0; j < 4; j++)
+            {
+                char        c   = str[i + j];
+                const char* pos = c ? strchr(BASE64_CHARS, c) : nullptr;
+                if (c == '=' && i + 4 == str.size() && j >= 2)
+                    padding++;
+                else if (!pos || padding)
+                    return false;
+                bits = (bits << 6) | (pos ? (uint32_t)(pos - BASE64_CHARS) : 0);
+            }
+
+            out.push_back((uint8_t)(bits >> 16));
+            if (padding < 2)
+                out.push_back((uint8_t)(bits >> 8));
+            if (padding < 1)
+                out.push_back((uint8_t)bits);
+        }
+        return true;
+    }
+
+    // blob type the values of a column are decoded as when their size matches, from its declared type
+    static BlobType GetDeclaredBlobType(sqlite3_stmt* stmt, int col)
+    {
+        const char* declType = sqlite3_column_decltype(stmt, col);
+        for (BlobType type : { BlobType::Vector2, BlobType::Vector3, BlobType::RGBA, BlobType::Matrix4x4 })
+        {
+            if (GetBlobType(declType, GetBlobSize(type)) == type)
+                return type;
+        }
+        return BlobType::None;
+    }
+
+    // header: "SQLB", version, varint column count, per column a length prefixed name and a blob type byte
+    // rows follow until the end of the buffer, every value is a tag byte followed by:
+    // zigzag varint (integer), 8 byte little endian double (float), length prefixed bytes (text, blob)
+    static void WriteBinaryColumn(Buffer& out, sqlite3_stmt* stmt, int col)
+    {
+        switch (sqlite3_column_type(stmt, col))
+        {
+        case SQLITE_INTEGER:
+        {
+            sqlite3_int64 value = sqlite3_column_int64(stmt, col);
+            out.push_back(BINARY_INTEGER);
+            WriteVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+            break;
+        }
+        case SQLITE_FLOAT:
+        {
+            double   value = sqlite3_column_double(stmt, col);
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+
+            out.push_back(BINARY_FLOAT);
+            for (int i = 0; i < 8; i++)
+                out.push_back((uint8_t)(bits >> (i * 8)));
+            break;
+        }
+        case SQLITE_BLOB:
+            out.push_back(BINARY_BLOB);
+            WriteBytes(out, sqlite3_column_blob(stmt, col), sqlite3_column_bytes(stmt, col));
+            break;
+        case SQLITE3_TEXT:
+            out.push_back(BINARY_TEXT);
+            WriteBytes(out, sqlite3_column_text(stmt, col), sqlite3_column_bytes(stmt, col));
+            break;
+        default:
+            out.push_back(BINARY_NULL);
+            break;
+        }
+    }
+
+    static bool ReadBinaryValue(Scripting::API::ICallbackInfo& info, Scripting::API::IObject& obj, const String& key, BlobType type, const uint8_t*& data, const uint8_t* end)
+    {
+        if (data >= end)
+            return false;
+
+        uint64_t value;
+        switch (*data++)
+        {
+        case BINARY_NULL:
+            obj.SetNull(key);
+            return true;
+        case BINARY_INTEGER:
+            if (!ReadVarint(data, end, value))
+                return false;
+            SetInteger(obj, key, (sqlite3_int64)(value >> 1) ^ -(sqlite3_int64)(value & 1));
+            return true;
+        case BINARY_FLOAT:
+        {
+            if (end - data < 8)
+                return false;
+
+            uint64_t bits {};
+            for (int i = 0; i < 8; i++)
+                bits |= (uint64_t)*data++ << (i * 8);
+
+            double number;
+            memcpy(&number, &bits, sizeof(number));
+            obj.Set(key, number);
+            return true;
+        }
+        case BINARY_TEXT:
+            if (!ReadVarint(data, end, value) || value > (uint64_t)(end - data))
+                return false;
+            obj.Set(key, String { (const char*)data, (size_t)value });
+            data += value;
+            return true;
+        case BINARY_BLOB:
+            if (!ReadVarint(data, end, value) || value > (uint64_t)(end - data))
+                return false;
+            SetBlob(info, obj, key, GetBlobSize(type) == (int)value ? type : BlobType::None, data);
+            data += value;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool DecodeBinary(Scripting::API::ICallbackInfo& info, const Buffer& buffer, Scripting::API::IObject& rows)
+    {
+        const uint8_t* data = buffer.data();
+        const uint8_t* end  = data + buffer.size();
+
+        if (buffer.size() < sizeof(BINARY_MAGIC) + 1 || memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0 || data[sizeof(BINARY_MAGIC)] != BINARY_VERSION)
+            return false;
+        data += sizeof(BINARY_MAGIC) + 1;
+
+        uint64_t colcount;
+        if (!ReadVarint(data, end, colcount) || colcount > (uint64_t)(end - data))
+            return false;
+
+        StringVector          colnames;
+        std::vector<BlobType> coltypes;
+        for (uint64_t col = 0; col < colcount; col++)
+        {
+            uint64_t length;
+            if (!ReadVarint(data, end, length) || length >= (uint64_t)(end - data) || data[length] > (uint8_t)BlobType::Matrix4x4)
+                return false;
+
+            colnames.emplace_back((const char*)data, (size_t)length);
+            coltypes.push_back((BlobType)data[length]);
+            data += length + 1;
+        }
+
+        int count {};
+        while (data < end)
+        {
+            auto& row = info.ObjectValue("SQLite Statement", nullptr);
+
+            for (size_t col = 0; col < colnames.size(); col++)
+            {
+                if (!ReadBinaryValue(info, row, colnames[col], coltypes[col], data, end))
+                    return false;
+            }
+
+            rows.Set(count, row);
+
+            count++;
+        }
+
+        return true;
+    }
+
+    static void WriteBinaryHeader(Buffer& out, sqlite3_stmt* stmt)
+    {
+        out.insert(out.end(), std::begin(BINARY_MAGIC), std::end(BINARY_MAGIC));
+        out.push_back(BINARY_VERSION);
+
+        int colcount = sqlite3_column_count(stmt);
+        WriteVarint(out, colcount);
+        for (int col = 0; col < colcount; col++)
+        {
+            const char* colname = sqlite3_column_name(stmt, col);
+            WriteBytes(out, colname, strlen(colname));
+            out.push_back((uint8_t)GetDeclaredBlobType(stmt, col));
+        }
+    }
+
+    static Scripting::API::IObject& CreateBufferObject(Scripting::API::ICallbackInfo& info, Buffer* buffer)
+    {
+        m_buffers.insert(buffer);
+
+        auto& objBuffer = info.ObjectValue("SqlBuffer", buffer);
+        {
+            objBuffer.SetFunction("size", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* buffer = (Buffer*)info.This().GetInternal();
+                if (!m_buffers.count(buffer))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Buffer was already freed");
+                    return;
+                }
+
+                info.GetReturnValue().Set((double)buffer->size());
+            });
+
+            objBuffer.SetFunction("decode", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* buffer = (Buffer*)info.This().GetInternal();
+                if (!m_buffers.count(buffer))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Buffer was already freed");
+                    return;
+                }
+
+                auto& rows = info.ObjectValue("SQLite Statement", nullptr);
+                if (!DecodeBinary(info, *buffer, rows))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Error decoding buffer: malformed data");
+                    return;
+                }
+
+                info.GetReturnValue().Set(rows);
+            });
+
+            objBuffer.SetFunction("base64", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* buffer = (Buffer*)info.This().GetInternal();
+                if (!m_buffers.count(buffer))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Buffer was already freed");
+                    return;
+                }
+
+                info.GetReturnValue().Set(EncodeBase64(*buffer));
+            });
+
+            objBuffer.SetFunction("free", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* buffer = (Buffer*)info.This().GetInternal();
+                if (m_buffers.erase(buffer))
+                    delete buffer;
+            });
+        }
+
+        return objBuffer;
+    }
+
+    static Scripting::API::IObject& CreateChangesetObject(Scripting::API::ICallbackInfo& info, Buffer* changeset)
+    {
+        m_buffers.insert(changeset);
+
+        auto& objChangeset = info.ObjectValue("SqlChangeset", changeset);
+        {
+            objChangeset.SetFunction("size", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* changeset = (Buffer*)info.This().GetInternal();
+                if (!m_buffers.count(changeset))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Changeset was already freed");
+                    return;
+                }
+
+                info.GetReturnValue().Set((double)changeset->size());
+            });
+
+            // apply(db) writes the changes into another database inside a single transaction
+            objChangeset.SetFunction("apply", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* changeset = (Buffer*)info.This().GetInternal();
+                if (!m_buffers.count(changeset))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Changeset was already freed");
+                    return;
+                }
+
+                sqlite3* db = info.Length() > 0 && info[0].IsObject() ? (sqlite3*)info[0].ToObject().GetInternal() : nullptr;
+                if (!m_databases.count(db))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] apply needs an open database");
+                    return;
+                }
+
+                String error;
+                if (!ApplyChangeset(db, *changeset, error))
+                    info.GetVM()->ThrowException("[sqlmodule] Error applying changeset: " + error);
+            });
+
+            // invert() returns a new changeset undoing this one
+            objChangeset.SetFunction("invert", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* changeset = (Buffer*)info.This().GetInternal();
+                if (!m_buffers.count(changeset))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Changeset was already freed");
+                    return;
+                }
+
+                Buffer* inverted = new Buffer;
+                if (!InvertChangeset(*changeset, *inverted))
+                {
+                    delete inverted;
+                    info.GetVM()->ThrowException("[sqlmodule] Error inverting changeset: malformed data");
+                    return;
+                }
+
+                info.GetReturnValue().Set(CreateChangesetObject(info, inverted));
+            });
+
+            objChangeset.SetFunction("free", [](Scripting::API::ICallbackInfo& info) {
+                Buffer* changeset = (Buffer*)info.This().GetInternal();
+                if (m_buffers.erase(changeset))
+                    delete changeset;
+            });
+        }
+
+        return objChangeset;
+    }
+
+    // steps whole rows until the slice is used up, a single row that takes longer can't be split: an interrupted
+    // sqlite3_step can't be resumed, so the progress handler only ends the query once it's past its deadline
+    static void StepSlicedQuery(SlicedQuery* query, std::chrono::steady_clock::time_point end)
+    {
+        int colcount = sqlite3_column_count(query->stmt);
+
+        DeadlineScope deadline(query->db, query->until);
+
+        do
+        {
+            int ret = sqlite3_step(query->stmt);
+            if (ret == SQLITE_ROW)
+            {
+                for (int col = 0; col < colcount; col++)
+                    WriteBinaryColumn(query->rows, query->stmt, col);
+                continue;
+            }
+
+            if (deadline.Interrupted())
+                query->error = "query timed out";
+            else if (ret != SQLITE_DONE)
+                query->error = sqlite3_errmsg(query->db);
+
+            sqlite3_finalize(query->stmt);
+            query->stmt = nullptr;
+            return;
+        } while (std::chrono::steady_clock::now() < end);
+    }
+
+    // the pulse budget is split evenly between the running queries, each takes at most its own sliceUs and what one
+    // leaves unused goes to the ones after it
+    static void StepSlicedQueries()
+    {
+        std::vector<SlicedQuery*> running;
+        for (SlicedQuery* query : m_slicedQueries)
+        {
+            if (query->stmt)
+                running.push_back(query);
+        }
+        if (running.empty())
+            return;
+
+        std::rotate(running.begin(), running.begin() + m_slicedOffset++ % running.size(), running.end());
+
+        auto now = std::chrono::steady_clock::now();
+        auto end = now + std::chrono::microseconds(m_slicedPulseUs);
+        for (size_t i = 0; i < running.size() && now < end; i++)
+        {
+            auto share = std::min<std::chrono::steady_clock::duration>((end - now) / (running.size() - i), std::chrono::microseconds(running[i]->sliceUs));
+            StepSlicedQuery(running[i], now + share);
+            now = std::chrono::steady_clock::now();
+        }
+    }
+
+    static void FinishSlicedQueries(sqlite3* db, const String& error)
+    {
+        for (SlicedQuery* query : m_slicedQueries)
+        {
+            if (query->db == db && query->stmt)
+            {
+                sqlite3_finalize(query->stmt);
+                query->stmt  = nullptr;
+                query->error = error;
+            }
+        }
+    }
+
+    static Scripting::API::IObject& CreateSlicedQueryObject(Scripting::API::ICallbackInfo& info, SlicedQuery* query)
+    {
+        m_slicedQueries.insert(query);
+
+        auto& objQuery = info.ObjectValue("SqlSlicedQuery", query);
+        {
+            objQuery.SetFunction("done", [](Scripting::API::ICallbackInfo& info) {
+                SlicedQuery* query = (SlicedQuery*)info.This().GetInternal();
+                if (!m_slicedQueries.count(query))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Query was already freed");
+                    return;
+                }
+
+                info.GetReturnValue().Set(query->stmt == nullptr);
+            });
+
+            // result() returns the rows like query once the statement is done, null before
+            objQuery.SetFunction("result", [](Scripting::API::ICallbackInfo& info) {
+                SlicedQuery* query = (SlicedQuery*)info.This().GetInternal();
+                if (!m_slicedQueries.count(query))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Query was already freed");
+                    return;
+                }
+
+                if (query->stmt)
+                {
+                    info.GetReturnValue().SetNull();
+                    return;
+                }
+
+                if (!query->error.empty())
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Error executing: " + query->error);
+                    return;
+                }
+
+                auto& rows = info.ObjectValue("SQLite Statement", nullptr);
+                DecodeBinary(info, query->rows, rows);
+                info.GetReturnValue().Set(rows);
+            });
+
+            // cancel() stops the query, result() fails afterwards
+            objQuery.SetFunction("cancel", [](Scripting::API::ICallbackInfo& info) {
+                SlicedQuery* query = (SlicedQuery*)info.This().GetInternal();
+                if (!m_slicedQueries.count(query) || !query->stmt)
+                    return;
+
+                sqlite3_finalize(query->stmt);
+                query->stmt  = nullptr;
+                query->error = "query was cancelled";
+            });
+
+            objQuery.SetFunction("free", [](Scripting::API::ICallbackInfo& info) {
+                SlicedQuery* query = (SlicedQuery*)info.This().GetInternal();
+                if (!m_slicedQueries.erase(query))
+                    return;
+
+                sqlite3_finalize(query->stmt);
+                delete query;
+            });
+        }
+
+        return objQuery;
+    }
+
+    static ConnectionPool* GetConnectionPool(sqlite3* db, String& error)
+    {
+        // in-memory databases and images can't be opened a second time
+        const char* filename = sqlite3_db_filename(db, "main");
+        if (!filename || !filename[0])
+        {
+            error = "queryAsync needs a database file";
+            return nullptr;
+        }
+
+        // with a rollback journal a read on a worker holds a shared lock, and the script's next commit would have
+        // to wait for it on the main thread
+        sqlite3_stmt* stmt = nullptr;
+        bool          wal  = false;
+        if (sqlite3_prepare_v2(db, "PRAGMA main.journal_mode", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+            wal = sqlite3_stricmp((const char*)sqlite3_column_text(stmt, 0), "wal") == 0;
+        sqlite3_finalize(stmt);
+        if (!wal)
+        {
+            error = "queryAsync needs the database in WAL mode (PRAGMA journal_mode = WAL)";
+            return nullptr;
+        }
+
+        auto it = m_connectionPools.find(db);
+        if (it != m_connectionPools.end())
+            return it->second;
+
+        sqlite3_vfs* vfs = nullptr;
+        sqlite3_file_control(db, "main", SQLITE_FCNTL_VFS_POINTER, &vfs);
+
+        ConnectionPool* pool  = new ConnectionPool {};
+        pool->filename        = filename;
+        pool->vfs             = vfs ? vfs->zName : "";
+        m_connectionPools[db] = pool;
+        return pool;
+    }
+
+    static void CloseWorkerConnection(sqlite3* conn)
+    {
+        DisableDeadlines(conn);
+        DisableBusyHandler(conn);
+        sqlite3_close_v2(conn);
+    }
+
+    // runs on a worker, opens a new connection when none is idle
+    static sqlite3* AcquireConnection(ConnectionPool* pool, String& error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            if (pool->closed)
+            {
+                error = "database was closed";
+                return nullptr;
+            }
+
+            if (!pool->idle.empty())
+            {
+                sqlite3* conn = pool->idle.back();
+                pool->idle.pop_back();
+                return conn;
+            }
+        }
+
+        sqlite3* conn;
+        if (sqlite3_open_v2(pool->filename.c_str(), &conn, SQLITE_OPEN_READONLY, pool->vfs.empty() ? 0 : pool->vfs.c_str()) != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(conn);
+            sqlite3_close_v2(conn);
+            return nullptr;
+        }
+
+        // server tables aren't registered, the server API may only be used on the main thread
+        if (m_lookasideSize && m_lookasideCount)
+            sqlite3_db_config(conn, SQLITE_DBCONFIG_LOOKASIDE, nullptr, (int)m_lookasideSize, (int)m_lookasideCount);
+        EnableDeadlines(conn);
+        EnableBusyHandler(conn, true);
+        RegisterSpatialFunctions(conn);
+        return conn;
+    }
+
+    static void ReleaseConnection(ConnectionPool* pool, sqlite3* conn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            if (!pool->closed)
+            {
+                pool->idle.push_back(conn);
+                return;
+            }
+        }
+
+        CloseWorkerConnection(conn);
+    }
+
+    // called once for every query that was submitted, from whichever thread finished it
+    static void ReleasePool(ConnectionPool* pool)
+    {
+        bool unused;
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            unused = --pool->users == 0 && pool->closed;
+        }
+
+        if (unused)
+            delete pool;
+    }
+
+    // idle connections are closed right away, the ones still running a query when their worker releases them
+    static void CloseConnectionPool(sqlite3* db)
+    {
+        auto it = m_connectionPools.find(db);
+        if (it == m_connectionPools.end())
+            return;
+
+        ConnectionPool* pool = it->second;
+        m_connectionPools.erase(it);
+
+        std::vector<sqlite3*> idle;
+        bool                  unused;
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            pool->closed = true;
+            idle.swap(pool->idle);
+            unused = pool->users == 0;
+        }
+
+        for (sqlite3* conn : idle)
+            CloseWorkerConnection(conn);
+        if (unused)
+            delete pool;
+    }
+
+    // copies the parameters of stmt from the script's values, so they can be bound on a pool connection; they go
+    // through a SELECT ? one at a time, any number of them works and each is converted once
+    static bool CaptureParams(Scripting::API::ICallbackInfo& info, sqlite3* db, sqlite3_stmt* stmt, std::vector<sqlite3_value*>& values)
+    {
+        int count = sqlite3_bind_parameter_count(stmt);
+        if (count == 0)
+            return true;
+
+        sqlite3_stmt* select;
+        int           ret = sqlite3_prepare_v3(db, "SELECT ?", -1, 0, &select, 0);
+        for (int i = 1; i <= count && ret == SQLITE_OK; i++)
+        {
+            if (info.Length() > 1 && info[1].IsObject())
+            {
+                const char* name = sqlite3_bind_parameter_name(stmt, i);
+                ret              = BindValue(select, 1, info[1].ToObject().Get(name && name[0] != '?' ? String { name + 1 } : std::to_string(i - 1)));
+            }
+
+            sqlite3_value* value = nullptr;
+            if (ret == SQLITE_OK && (ret = sqlite3_step(select)) == SQLITE_ROW)
+                value = sqlite3_value_dup(sqlite3_column_value(select, 0));
+            sqlite3_reset(select);
+
+            ret = value ? SQLITE_OK : (ret == SQLITE_ROW ? SQLITE_NOMEM : ret);
+            if (value)
+                values.push_back(value);
+        }
+        sqlite3_finalize(select);
+
+        if (ret != SQLITE_OK)
+            info.GetVM()->ThrowException("[sqlmodule] Error binding parameters: " + String(sqlite3_errstr(ret)));
+        return ret == SQLITE_OK;
+    }
+
+    static void ReleaseAsyncQuery(AsyncQuery* query)
+    {
+        if (--query->references > 0)
+            return;
+
+        for (sqlite3_value* value : query->params)
+            sqlite3_value_free(value);
+        delete query;
+    }
+
+    static void ExecuteAsyncQuery(AsyncQuery* query, sqlite3* conn)
+    {
+        sqlite3_stmt* stmt = nullptr;
+
+        int ret = sqlite3_prepare_v3(conn, query->sql.c_str(), -1, 0, &stmt, 0);
+        for (size_t i = 0; i < query->params.size() && ret == SQLITE_OK; i++)
+            ret = sqlite3_bind_value(stmt, (int)i + 1, query->params[i]);
+
+        if (ret != SQLITE_OK)
+        {
+            query->error = sqlite3_errmsg(conn);
+            sqlite3_finalize(stmt);
+            return;
+        }
+
+        int colcount = sqlite3_column_count(stmt);
+
+        DeadlineScope deadline(conn, query->until, &query->cancelled);
+        while ((ret = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            for (int col = 0; col < colcount; col++)
+                WriteBinaryColumn(query->rows, stmt, col);
+        }
+
+        if (deadline.Interrupted())
+            query->error = "query timed out";
+        else if (ret != SQLITE_DONE)
+            query->error = sqlite3_errmsg(conn);
+
+        sqlite3_finalize(stmt);
+    }
+
+    // runs on a worker
+    static void RunAsyncQuery(AsyncQuery* query)
+    {
+        if (!query->cancelled)
+        {
+            if (sqlite3* conn = AcquireConnection(query->pool, query->error))
+            {
+                ExecuteAsyncQuery(query, conn);
+                ReleaseConnection(query->pool, conn);
+            }
+        }
+
+        if (query->cancelled)
+            query->error = query->cancelReason;
+
+        ReleasePool(query->pool);
+        query->done = true;
+        ReleaseAsyncQuery(query);
+    }
+
+    // a queued query is dropped right away, a running one stops at its next progress check and is finished by its
+    // worker, the script thread never waits for it
+    static void CancelAsyncQuery(AsyncQuery* query, const String& reason)
+    {
+        if (query->done || query->cancelled)
+            return;
+
+        query->cancelReason = reason;
+        query->cancelled    = true;
+
+        if (!CancelJob(query->job))
+            return;
+
+        query->error = reason;
+        ReleasePool(query->pool);
+        query->done = true;
+        ReleaseAsyncQuery(query);
+    }
+
+    static void FinishAsyncQueries(sqlite3* db, const String& error)
+    {
+        for (AsyncQuery* query : m_asyncQueries)
+        {
+            if (query->db == db)
+                CancelAsyncQuery(query, error);
+        }
+
+        CloseConnectionPool(db);
+    }
+
+    static Scripting::API::IObject& CreateAsyncQueryObject(Scripting::API::ICallbackInfo& info, AsyncQuery* query)
+    {
+        m_asyncQueries.insert(query);
+
+        auto& objQuery = info.ObjectValue("SqlAsyncQuery", query);
+        {
+            objQuery.SetFunction("done", [](Scripting::API::ICallbackInfo& info) {
+                AsyncQuery* query = (AsyncQuery*)info.This().GetInternal();
+                if (!m_asyncQueries.count(query))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Query was already freed");
+                    return;
+                }
+
+                info.GetReturnValue().Set(query->done.load());
+            });
+
+            // result() returns the rows like query once the statement is done, null before
+            objQuery.SetFunction("result", [](Scripting::API::ICallbackInfo& info) {
+                AsyncQuery* query = (AsyncQuery*)info.This().GetInternal();
+                if (!m_asyncQueries.count(query))
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Query was already freed");
+                    return;
+                }
+
+                if (!query->done)
+                {
+                    info.GetReturnValue().SetNull();
+                    return;
+                }
+
+                if (!query->error.empty())
+                {
+                    info.GetVM()->ThrowException("[sqlmodule] Error executing: " + query->error);
+                    return;
+                }
+
+                auto& rows = info.ObjectValue("SQLite Statement", nullptr);
+                DecodeBinary(info, query->rows, rows);
+                info.GetReturnValue().Set(rows);
+            });
+
+            // cancel() stops the query, result() fails afterwards unless it already finished
+            objQuery.SetFunction("cancel", [](Scripting::API::ICallbackInfo& info) {
+                AsyncQuery* query = (AsyncQuery*)info.This().GetInternal();
+                if (m_asyncQueries.count(query))
+                    CancelAsyncQuery(query, "query was cancelled");
+            });
+
+            objQuery.SetFunction("free", [](Scripting::API::ICallbackInfo& info) {
+                AsyncQuery* query = (AsyncQuery*)info.This().GetInternal();
+                if (!m_asyncQueries.erase(query))
+                    return;
+
+                CancelAsyncQuery(query, "query was cancelled");
+                ReleaseAsyncQuery(query);
+            });
+        }
+
+        return objQuery;
+    }
+
+    struct ColumnKey
+    {
+        int           type {};
+        sqlite3_int64 integer {};
+        double        number {};
+        String        bytes;
+
+        bool operator==(const ColumnKey& other) const
+        {
+            return type == other.type && integer == other.integer && number == other.number && bytes == other.bytes;
+        }
+    };
+
+    // compares the value without converting it, SetColumn still has to see the original type
+    static ColumnKey GetColumnKey(sqlite3_stmt* stmt, int col)
+    {
+        ColumnKey key;
+        key.type = sqlite3_column_type(stmt, col);
+
+        switch (key.type)
+        {
+        case SQLITE_INTEGER:
+            key.integer = sqlite3_column_int64(stmt, col);
+            break;
+        case SQLITE_FLOAT:
+            key.number = sqlite3_column_double(stmt, col);
+            break;
+        case SQLITE_BLOB:
+        case SQLITE3_TEXT:
+            key.bytes.assign((const char*)sqlite3_column_blob(stmt, col), sqlite3_column_bytes(stmt, col));
+            break;
+        default:
+            break;
+        }
+
+        return key;
+    }
+
+    // timeoutMs of the options object at index, -1 (the connection's default) if there is none
+    static int GetTimeoutOption(Scripting::API::ICallbackInfo& info, int index)
+    {
+        if (info.Length() > index && info[index].IsObject() && info[index].ToObject().Get("timeoutMs").IsNumber())
+            return (int)info[index].ToObject().Get("timeoutMs").ToNumber();
+        return -1;
+    }
+
+    // bind = false leaves the parameters unbound, for callers that only need the statement's shape
+    static sqlite3_stmt* PrepareStatement(Scripting::API::ICallbackInfo& info, sqlite3* db, bool bind = true)
+    {
+        sqlite3_stmt* stmt;
+
+        int ret = sqlite3_prepare_v3(db, info[0].ToString().c_str(), -1, 0, &stmt, 0);
+        if (ret != SQLITE_OK)
+        {
+            info.GetVM()->ThrowException("[sqlmodule] Error in query: " + String(sqlite3_errmsg(db)));
+            sqlite3_finalize(stmt);
+            return nullptr;
+        }
+
+        if (bind && info.Length() > 1 && info[1].IsObject())
+        {
+            ret = BindParams(stmt, info[1].ToObject());
+            if (ret != SQLITE_OK)
+            {
+                info.GetVM()->ThrowException("[sqlmodule] Error binding parameters: " + String(sqlite3_errstr(ret)));
+                sqlite3_finalize(stmt);
+                return nullptr;
+            }
+        }
+
+        return stmt;
+    }
+
+    static Scripting::API::IObject& CollectRows(Scripting::API::ICallbackInfo& info, sqlite3_stmt* stmt)
+    {
+        auto& rows = info.ObjectValue("SQLite Statement", nullptr);
+
+        StringVector colnames;
+        for (int col = 0; col < sqlite3_column_count(stmt); col++)
+            colnames.emplace_back(sqlite3_column_name(stmt, col));
+
+        int count {};
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            auto& row = info.ObjectValue("SQLite Statement", nullptr);
+
+            for (int col = 0; col < (int)colnames.size(); col++)
+                SetColumn(info, row, colnames[col], stmt, col);
+
+            rows.Set(count, row);
+
+            count++;
+        }
+
+        return rows;
+    }
+
+    static bool GetVector3(Scripting::API::IValue& value, double out[3])
+    {
+        if (!value.IsObject())
+            return false;
+
+        auto& obj = value.ToObject();
+        if (!obj.Get("x").IsNumber() || !obj.Get("y").IsNumber() || !obj.Get("z").IsNumber())
+            return false;
+
+        out[0] = obj.Get("x").ToNumber();
+        out[1] = obj.Get("y").ToNumber();
+        out[2] = obj.Get("z").ToNumber();
+        return true;
+    }
+
+    // runs a query built by GetSpatialQuery with the given values bound to ?1...
+    static void QuerySpatialIndex(Scripting::API::ICallbackInfo& info, bool box, const double* values, int count)
+    {
+        auto&    index = info.This();
+        sqlite3* db    = (sqlite3*)index.GetInternal();
+
+        String sql = GetSpatialQuery(index.Get("table").ToString(), index.Get("idColumn").ToString(), index.Get("posColumn").ToString(), box);
+
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v3(db, sql.c_str(), -1, 0, &stmt, 0) != SQLITE_OK)
+        {
+            info.GetVM()->ThrowException("[sqlmodule] Error in query: " + String(sqlite3_errmsg(db)));
+            sqlite3_finalize(stmt);
+            return;
+        }
+
+        for (int i = 0; i < count; i++)
+            sqlite3_bind_double(stmt, i + 1, values[i]);
+
+        DeadlineScope deadline(db);
+
+        auto& rows = CollectRows(info, stmt);
+        if (deadline.Interrupted())
+            info.GetVM()->ThrowException("[sqlmodule] Query timed out");
+        else
+            info.GetReturnValue().Set(rows);
+
+        sqlite3_finalize(stmt);
+    }
+
+    // "a, b" or [ "a", "b" ]
+    static StringVector GetStringList(Scripting::API::IValue& value)
+    {
+        StringVector list;
+
+        if (value.IsString())
+        {
+            std::stringstream stream(value.ToString());
+            for (String item; std::getline(stream, item, ',');)
+            {
+                item.erase(0, item.find_first_not_of(' '));
+                item.erase(item.find_last_not_of(' ') + 1);
+                if (!item.empty())
+                    list.push_back(item);
+            }
+        }
+        else if (value.IsObject())
+        {
+            auto& obj = value.ToObject();
+            for (int i = 0; obj.Get(std::to_string(i)).IsString(); i++)
+                list.push_back(obj.Get(std::to_string(i)).ToString());
+        }
+
+        return list;
+    }
+
+    static uint32_t GetConfigNumber(const std::unordered_map<std::string, std::string>& config, const char* key)
+    {
+        uint32_t value = 0;
+
+        auto it = config.find(key);
+        if (it != config.end())
+            std::from_chars(it->second.data(), it->second.data() + it->second.size(), value);
+        return value;
+    }
+
     DLLEXPORT void OnLoad(String* name, String* description, String* author, ModuleAPI::IModuleAPI* api)
     {
         *name        = "SQL Module";
         *description = "";
         *author      = "lucx";
 
-        m_api = api;
-    }
+        m_api = api;
+
+        auto& config = m_api->GetConfig();
+
+        auto int64Mode = config.find("sql_int64");
+        if (int64Mode != config.end() && int64Mode->second == "number")
+            m_int64Mode = Int64Mode::Number;
+
+        // has to happen before anything initializes SQLite
+        // opt-in: the pools never give memory back, so released cache memory wouldn't reach the server again
+        auto allocator = config.find("sql_allocator");
+        if (allocator != config.end() && allocator->second == "pool")
+            InstallPoolAllocator();
+
+        auto hugePages = config.find("sql_pagecache_hugepages");
+        ReservePageCache(GetConfigNumber(config, "sql_pagecache_pages"), hugePages != config.end() && hugePages->second == "true");
+
+        m_lookasideSize  = GetConfigNumber(config, "sql_lookaside_size");
+        m_lookasideCount = GetConfigNumber(config, "sql_lookaside_count");
+
+        if (config.count("sql_backup_slice_us"))
+            m_backupSliceUs = GetConfigNumber(config, "sql_backup_slice_us");
+        if (config.count("sql_sliced_max_ms"))
+            m_slicedMaxMs = GetConfigNumber(config, "sql_sliced_max_ms");
+        if (config.count("sql_sliced_pulse_us"))
+            m_slicedPulseUs = GetConfigNumber(config, "sql_sliced_pulse_us");
+
+        SetMemoryBudget((sqlite3_int64)GetConfigNumber(config, "sql_memory_budget_mb") * 1024 * 1024);
+
+        // the script's connections wait on the main thread, a lock held for long would stall the whole server
+        uint32_t busyTimeoutMs       = 250;
+        uint32_t busyWorkerTimeoutMs = 5000;
+        uint32_t busyMaxBackoffMs    = 20;
+        if (config.count("sql_busy_timeout_ms"))
+            busyTimeoutMs = GetConfigNumber(config, "sql_busy_timeout_ms");
+        if (config.count("sql_async_busy_timeout_ms"))
+            busyWorkerTimeoutMs = GetConfigNumber(config, "sql_async_busy_timeout_ms");
+        if (config.count("sql_busy_backoff_max_ms"))
+            busyMaxBackoffMs = GetConfigNumber(config, "sql_busy_backoff_max_ms");
+        SetBusyLimits((int)busyTimeoutMs, (int)busyWorkerTimeoutMs, (int)busyMaxBackoffMs);
+
+        uint32_t asyncWorkers = 2;
+        uint32_t asyncAgingMs = 500;
+        if (config.count("sql_async_workers"))
+            asyncWorkers = GetConfigNumber(config, "sql_async_workers");
+        if (config.count("sql_async_aging_ms"))
+            asyncAgingMs = GetConfigNumber(config, "sql_async_aging_ms");
+        ConfigureWorkers((int)asyncWorkers, (int)asyncAgingMs);
+        SetResourceLimits(GetConfigNumber(config, "sql_async_resource_running"), GetConfigNumber(config, "sql_async_resource_queued"));
+
+        RegisterStatsVfs();
+        RegisterUringVfs();
+
+#ifdef SQLMODULE_LATENCY_VFS
+        LatencyConfig latency;
+        latency.readUs     = GetConfigNumber(config, "sql_latency_read_us");
+        latency.writeUs    = GetConfigNumber(config, "sql_latency_write_us");
+        latency.syncUs     = GetConfigNumber(config, "sql_latency_sync_us");
+        latency.lockUs     = GetConfigNumber(config, "sql_latency_lock_us");
+        latency.jitterUs   = GetConfigNumber(config, "sql_latency_jitter_us");
+        latency.stallEvery = GetConfigNumber(config, "sql_latency_stall_every");
+        latency.stallMs    = GetConfigNumber(config, "sql_latency_stall_ms");
+        RegisterLatencyVfs(latency);
+#endif
+    }
+
+    DLLEXPORT void RegisterFunctions(Scripting::API::IVM* vm)
+    {
+        if (!m_resourceIds.count(vm))
+            m_resourceIds.emplace(vm, (ResourceId)m_resourceIds.size() + 1);
+        vm->Global().Set("SQLITE_RESOURCE_ID", m_resourceIds[vm]);
+
+        vm->Global().Set("SQLITE_OPEN_READWRITE", SQLITE_OPEN_READWRITE);
+        vm->Global().Set("SQLITE_OPEN_CREATE", SQLITE_OPEN_CREATE);
+        vm->Global().Set("SQLITE_OPEN_DELETEONCLOSE", SQLITE_OPEN_DELETEONCLOSE);
+        vm->Global().Set("SQLITE_OPEN_EXCLUSIVE", SQLITE_OPEN_EXCLUSIVE);
+        vm->Global().Set("SQLITE_OPEN_AUTOPROXY", SQLITE_OPEN_AUTOPROXY);
+        vm->Global().Set("SQLITE_OPEN_URI", SQLITE_OPEN_URI);
+        vm->Global().Set("SQLITE_OPEN_MEMORY", SQLITE_OPEN_MEMORY);
+        vm->Global().Set("SQLITE_OPEN_MAIN_DB", SQLITE_OPEN_MAIN_DB);
+        vm->Global().Set("SQLITE_OPEN_TEMP_DB", SQLITE_OPEN_TEMP_DB);
+        vm->Global().Set("SQLITE_OPEN_TRANSIENT_DB", SQLITE_OPEN_TRANSIENT_DB);
+        vm->Global().Set("SQLITE_OPEN_MAIN_JOURNAL", SQLITE_OPEN_MAIN_JOURNAL);
+        vm->Global().Set("SQLITE_OPEN_TEMP_JOURNAL", SQLITE_OPEN_TEMP_JOURNAL);
+        vm->Global().Set("SQLITE_OPEN_SUBJOURNAL", SQLITE_OPEN_SUBJOURNAL);
+        vm->Global().Set("SQLITE_OPEN_SUPER_JOURNAL", SQLITE_OPEN_SUPER_JOURNAL);
+        vm->Global().Set("SQLITE_OPEN_NOMUTEX", SQLITE_OPEN_NOMUTEX);
+        vm->Global().Set("SQLITE_OPEN_FULLMUTEX", SQLITE_OPEN_FULLMUTEX);
+        vm->Global().Set("SQLITE_OPEN_SHAREDCACHE", SQLITE_OPEN_SHAREDCACHE);
+        vm->Global().Set("SQLITE_OPEN_PRIVATECACHE", SQLITE_OPEN_PRIVATECACHE);
+        vm->Global().Set("SQLITE_OPEN_WAL", SQLITE_OPEN_WAL);
+        vm->Global().Set("SQLITE_OPEN_NOFOLLOW", SQLITE_OPEN_NOFOLLOW);
+        vm->Global().Set("SQLITE_OPEN_EXRESCODE", SQLITE_OPEN_EXRESCODE);
+
+        vm->RegisterGlobalFunction("sqlite3_open", [](Scripting::API::ICallbackInfo& info) {
+            String filename = info[0].ToString();
+            int    flags    = info[1].ToNumber();
+            String zVfs     = "";
+            String persistTo;
+            int    intervalMs = 5000;
+            bool   image      = false;
+            if (info.Length() - 1 > 1 && info[2].IsObject())
+            {
+                auto& options = info[2].ToObject();
+                if (options.Get("vfs").IsString())
+                    zVfs = options.Get("vfs").ToString();
+                if (options.Get("persistTo").IsString())
+                    persistTo = options.Get("persistTo").ToString();
+                if (options.Get("intervalMs").IsNumber())
+                    intervalMs = options.Get("intervalMs").ToNumber();
+                image = options.Get("image").ToBoolean();
+            }
+            else if (info.Length() - 1 > 1)
+                zVfs = info[2].ToString();
+
+            sqlite3* db;
+            String   error;
+            if (!image)
+                sqlite3_open_v2(filename.c_str(), &db, flags, zVfs.empty() ? 0 : zVfs.c_str());
+            else if (!OpenImage(filename, &db, error))
+            {
+                info.GetVM()->ThrowException("[sqlmodule] Error loading " + filename + ": " + error);
+                return;
+            }
+
+            if (!persistTo.empty() && !EnableSnapshots(db, persistTo, intervalMs, error))
+            {
+                sqlite3_close_v2(db);
+                info.GetVM()->ThrowException("[sqlmodule] Error restoring " + persistTo + ": " + error);
+                return;
+            }
+
+            if (m_lookasideSize && m_lookasideCount)
+                sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, nullptr, (int)m_lookasideSize, (int)m_lookasideCount);
+            m_databases.insert(db);
+            TrackDatabase(db);
+            EnableDeadlines(db);
+            EnableBusyHandler(db);
+            RegisterSpatialFunctions(db);
+            RegisterServerTables(db, m_api->GetServerAPI());
+
+            auto& sqldatabase = info.ObjectValue("SqlDatabase", db);
+            {
+                sqldatabase.SetFunction("exec", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+
+                    DeadlineScope deadline(db, GetTimeoutOption(info, 1));
+
+                    char* errmsg = 0;
+                    sqlite3_exec(db, info[0].ToString().c_str(), 0, 0, &errmsg);
+
+                    if (deadline.Interrupted())
+                        info.GetVM()->ThrowException("[sqlmodule] Query timed out");
+                    else if (errmsg)
+                        info.GetVM()->ThrowException("[sqlmodule] Error executing: " + String(errmsg));
+                    sqlite3_free(errmsg);
+                });
+
+                sqldatabase.SetFunction("queryOne", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+
+                    DeadlineScope deadline(db, GetTimeoutOption(info, 2));
+
+                    sqlite3_stmt* stmt = PrepareStatement(info, db);
+                    if (!stmt)
+                        return;
+
+                    if (sqlite3_step(stmt) == SQLITE_ROW)
+                    {
+                        auto& objStmt = info.ObjectValue("sqlStmt", nullptr);
+
+                        for (int col = 0; col < sqlite3_column_count(stmt); col++)
+                            SetColumn(info, objStmt, sqlite3_column_name(stmt, col), stmt, col);
+
+                        info.GetReturnValue().Set(objStmt);
+                    }
+                    else if (deadline.Interrupted())
+                        info.GetVM()->ThrowException("[sqlmodule] Query timed out");
+                    else
+                        info.GetReturnValue().SetNull();
+
+                    sqlite3_finalize(stmt);
+                });
+
+                sqldatabase.SetFunction("query", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+
+                    // { timeoutMs } in the options stops the query once it runs longer than that
+                    DeadlineScope deadline(db, GetTimeoutOption(info, 2));
+
+                    sqlite3_stmt* stmt = PrepareStatement(info, db);
+                    if (!stmt)
+                        return;
+
+                    StringVector colnames;
+                    for (int col = 0; col < sqlite3_column_count(stmt); col++)
+                        colnames.emplace_back(sqlite3_column_name(stmt, col));
+
+                    // { key: "column", group: bool } returns the rows as an object keyed by that column instead of an array
+                    int  keycol = -1;
+                    bool group  = false;
+                    if (info.Length() > 2 && info[2].IsObject())
+                    {
+                        auto& options = info[2].ToObject();
+                        if (options.Get("key").IsString())
+                        {
+                            String keyname = options.Get("key").ToString();
+                            keycol         = (int)(std::find(colnames.begin(), colnames.end(), keyname) - colnames.begin());
+                            if (keycol == (int)colnames.size())
+                            {
+                                info.GetVM()->ThrowException("[sqlmodule] Error in query: no such key column: " + keyname);
+                                sqlite3_finalize(stmt);
+                                return;
+                            }
+                        }
+                        group = options.Get("group").ToBoolean();
+                    }
+
+                    auto& objStmt = info.ObjectValue("SQLite Statement", nullptr);
+
+                    UnorderedMap<String, Pair<Scripting::API::IObject*, int>> groups;
+
+                    int count {};
+                    while (sqlite3_step(stmt) == SQLITE_ROW)
+                    {
+                        // read before SetColumn, the type is undefined once the value was converted
+                        int keytype = keycol >= 0 ? sqlite3_column_type(stmt, keycol) : SQLITE_NULL;
+
+                        // a NULL key has no property name of its own, it would collide with the TEXT key "null"
+                        if (keycol >= 0 && keytype == SQLITE_NULL)
+                            continue;
+
+                        auto& objStmt2 = info.ObjectValue("SQLite Statement", nullptr);
+
+                        for (int col = 0; col < (int)colnames.size(); col++)
+                            SetColumn(info, objStmt2, colnames[col], stmt, col);
+
+                        if (keycol < 0)
+                        {
+                            objStmt.Set(count, objStmt2);
+
+                            count++;
+                            continue;
+                        }
+
+                        // integer keys stay integers so they index the same as in script (matters for lua tables)
+                        sqlite3_int64 intkey = keytype == SQLITE_INTEGER ? sqlite3_column_int64(stmt, keycol) : 0;
+                        bool          isint  = keytype == SQLITE_INTEGER && intkey >= INT32_MIN && intkey <= INT32_MAX;
+                        String        key    = isint ? std::to_string(intkey) : (const char*)sqlite3_column_text(stmt, keycol);
+
+                        Scripting::API::IObject* target = &objStmt2;
+                        if (group)
+                        {
+                            auto& entry    = groups[key];
+                            bool  newgroup = !entry.first;
+                            if (newgroup)
+                                entry.first = &info.ObjectValue("SQLite Statement", nullptr);
+
+                            entry.first->Set(entry.second++, objStmt2);
+                            if (!newgroup)
+                                continue;
+
+                            target = entry.first;
+                        }
+
+                        if (isint)
+                            objStmt.Set((int)intkey, *target);
+                        else
+                            objStmt.Set(key, *target);
+                    }
+
+                    sqlite3_finalize(stmt);
+
+                    if (deadline.Interrupted())
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] Query timed out");
+                        return;
+                    }
+
+                    info.GetReturnValue().Set(objStmt);
+                });
+
+                sqldatabase.SetFunction("queryNested", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+
+                    DeadlineScope deadline(db, GetTimeoutOption(info, 2));
+
+                    if (info.Length() < 3 || !info[2].IsObject())
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] queryNested expects options { groupBy, childKey }");
+                        return;
+                    }
+
+                    auto&  options  = info[2].ToObject();
+                    String groupBy  = options.Get("groupBy").ToString();
+                    String childKey = options.Get("childKey").ToString();
+                    String prefix   = childKey + ".";
+
+                    sqlite3_stmt* stmt = PrepareStatement(info, db);
+                    if (!stmt)
+                        return;
+
+                    // columns named "<childKey>.<name>" belong to the child rows, everything else to the parent
+                    StringVector colnames;
+                    Vector<bool> childcols;
+                    int          groupcol = -1;
+                    for (int col = 0; col < sqlite3_column_count(stmt); col++)
+                    {
+                        String colname = sqlite3_column_name(stmt, col);
+                        bool   child   = colname.compare(0, prefix.size(), prefix) == 0;
+
+                        if (!child && colname == groupBy)
+                            groupcol = col;
+
+                        colnames.emplace_back(child ? colname.substr(prefix.size()) : colname);
+                        childcols.push_back(child);
+                    }
+
+                    if (groupcol < 0)
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] Error in query: no such group column: " + groupBy);
+                        sqlite3_finalize(stmt);
+                        return;
+                    }
+
+                    auto& objStmt = info.ObjectValue("SQLite Statement", nullptr);
+
+                    // rows have to be ordered by the group column, a parent ends as soon as its key changes
+                    ColumnKey                lastkey;
+                    Scripting::API::IObject* children = nullptr;
+
+                    int count {};
+                    int childcount {};
+                    while (sqlite3_step(stmt) == SQLITE_ROW)
+                    {
+                        ColumnKey key = GetColumnKey(stmt, groupcol);
+                        if (!children || !(key == lastkey))
+                        {
+                            auto& parent = info.ObjectValue("SQLite Statement", nullptr);
+
+                            for (int col = 0; col < (int)colnames.size(); col++)
+                            {
+                                if (!childcols[col])
+                                    SetColumn(info, parent, colnames[col], stmt, col);
+                            }
+
+                            children = &info.ObjectValue("SQLite Statement", nullptr);
+                            parent.Set(childKey, *children);
+
+                            objStmt.Set(count, parent);
+
+                            lastkey    = std::move(key);
+                            childcount = 0;
+                            count++;
+                        }
+
+                        // a LEFT JOIN without a match has only NULL child columns
+                        bool haschild = false;
+                        for (int col = 0; col < (int)colnames.size() && !haschild; col++)
+                            haschild = childcols[col] && sqlite3_column_type(stmt, col) != SQLITE_NULL;
+
+                        if (!haschild)
+                            continue;
+
+                        auto& child = info.ObjectValue("SQLite Statement", nullptr);
+
+                        for (int col = 0; col < (int)colnames.size(); col++)
+                        {
+                            if (childcols[col])
+                                SetColumn(info, child, colnames[col], stmt, col);
+                        }
+
+                        children->Set(childcount, child);
+
+                        childcount++;
+                    }
+
+                    sqlite3_finalize(stmt);
+
+                    if (deadline.Interrupted())
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] Query timed out");
+                        return;
+                    }
+
+                    info.GetReturnValue().Set(objStmt);
+                });
+
+                sqldatabase.SetFunction("queryJSON", [](Scripting::API::ICallbackInfo& info) {
+                    // reused between calls so large results don't have to grow a fresh buffer every time
+                    static String json;
+
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+
+                    DeadlineScope deadline(db, GetTimeoutOption(info, 2));
+
+                    sqlite3_stmt* stmt = PrepareStatement(info, db);
+                    if (!stmt)
+                        return;
+
+                    StringVector keys;
+                    for (int col = 0; col < sqlite3_column_count(stmt); col++)
+                    {
+                        String      key;
+                        const char* colname = sqlite3_column_name(stmt, col);
+                        AppendJSONString(key, colname, strlen(colname));
+                        keys.emplace_back(key + ':');
+                    }
+
+                    json.clear();
+                    json += '[';
 
-    DLLEXPORT void RegisterFunctions(Scripting::API::IVM* vm)
-    {
-        vm->Global().Set("SQLITE_OPEN_READWRITE", SQLITE_OPEN_READWRITE);
-        vm->Global().Set("SQLITE_OPEN_CREATE", SQLITE_OPEN_CREATE);
-        vm->Global().Set("SQLITE_OPEN_DELETEONCLOSE", SQLITE_OPEN_DELETEONCLOSE);
-        vm->Global().Set("SQLITE_OPEN_EXCLUSIVE", SQLITE_OPEN_EXCLUSIVE);
-        vm->Global().Set("SQLITE_OPEN_AUTOPROXY", SQLITE_OPEN_AUTOPROXY);
-        vm->Global().Set("SQLITE_OPEN_URI", SQLITE_OPEN_URI);
-        vm->Global().Set("SQLITE_OPEN_MEMORY", SQLITE_OPEN_MEMORY);
-        vm->Global().Set("SQLITE_OPEN_MAIN_DB", SQLITE_OPEN_MAIN_DB);
-        vm->Global().Set("SQLITE_OPEN_TEMP_DB", SQLITE_OPEN_TEMP_DB);
-        vm->Global().Set("SQLITE_OPEN_TRANSIENT_DB", SQLITE_OPEN_TRANSIENT_DB);
-        vm->Global().Set("SQLITE_OPEN_MAIN_JOURNAL", SQLITE_OPEN_MAIN_JOURNAL);
-        vm->Global().Set("SQLITE_OPEN_TEMP_JOURNAL", SQLITE_OPEN_TEMP_JOURNAL);
-        vm->Global().Set("SQLITE_OPEN_SUBJOURNAL", SQLITE_OPEN_SUBJOURNAL);
-        vm->Global().Set("SQLITE_OPEN_SUPER_JOURNAL", SQLITE_OPEN_SUPER_JOURNAL);
-        vm->Global().Set("SQLITE_OPEN_NOMUTEX", SQLITE_OPEN_NOMUTEX);
-        vm->Global().Set("SQLITE_OPEN_FULLMUTEX", SQLITE_OPEN_FULLMUTEX);
-        vm->Global().Set("SQLITE_OPEN_SHAREDCACHE", SQLITE_OPEN_SHAREDCACHE);
-        vm->Global().Set("SQLITE_OPEN_PRIVATECACHE", SQLITE_OPEN_PRIVATECACHE);
-        vm->Global().Set("SQLITE_OPEN_WAL", SQLITE_OPEN_WAL);
-        vm->Global().Set("SQLITE_OPEN_NOFOLLOW", SQLITE_OPEN_NOFOLLOW);
-        vm->Global().Set("SQLITE_OPEN_EXRESCODE", SQLITE_OPEN_EXRESCODE);
+                    while (sqlite3_step(stmt) == SQLITE_ROW)
+                    {
+                        if (json.size() > 1)
+                            json += ',';
 
-        vm->RegisterGlobalFunction("sqlite3_open", [](Scripting::API::ICallbackInfo& info) {
-            String filename = info[0].ToString();
-            int    flags    = info[1].ToNumber();
-            String zVfs     = "";
-            if (info.Length() - 1 > 1)
-                zVfs = info[2].ToString();
+                        json += '{';
+                        for (int col = 0; col < (int)keys.size(); col++)
+                        {
+                            if (col > 0)
+                                json += ',';
 
-            sqlite3* db;
-            sqlite3_open_v2(filename.c_str(), &db, flags, zVfs.empty() ? 0 : zVfs.c_str());
+                            json += keys[col];
+                            AppendJSONColumn(json, stmt, col);
+                        }
+                        json += '}';
+                    }
 
-            auto& sqldatabase = info.ObjectValue("SqlDatabase", db);
-            {
-                sqldatabase.SetFunction("exec", [](Scripting::API::ICallbackInfo& info) {
-                    char* errmsg = 0;
-                    sqlite3_exec((sqlite3*)info.This().GetInternal(), info[0].ToString().c_str(), 0, 0, &errmsg);
+                    json += ']';
 
-                    if (errmsg)
-                        info.GetVM()->ThrowException("[sqlmodule] Error executing: " + String(errmsg));
+                    sqlite3_finalize(stmt);
+
+                    if (deadline.Interrupted())
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] Query timed out");
+                        return;
+                    }
+
+                    info.GetReturnValue().Set(json);
                 });
 
-                sqldatabase.SetFunction("queryOne", [](Scripting::API::ICallbackInfo& info) {
+                sqldatabase.SetFunction("queryBinary", [](Scripting::API::ICallbackInfo& info) {
                     sqlite3* db = (sqlite3*)info.This().GetInternal();
 
-                    sqlite3_stmt* stmt;
+                    DeadlineScope deadline(db, GetTimeoutOption(info, 2));
+
+                    sqlite3_stmt* stmt = PrepareStatement(info, db);
+                    if (!stmt)
+                        return;
+
+                    Buffer* buffer = new Buffer;
+                    WriteBinaryHeader(*buffer, stmt);
 
-                    int ret = sqlite3_prepare_v3(db, info[0].ToString().c_str(), -1, 0, &stmt, 0);
-                    if (ret != SQLITE_OK)
+                    int colcount = sqlite3_column_count(stmt);
+                    while (sqlite3_step(stmt) == SQLITE_ROW)
                     {
-                        info.GetVM()->ThrowException("[sqlmodule] Error in query: " + String(sqlite3_errmsg(db)));
-                        sqlite3_finalize(stmt);
+                        for (int col = 0; col < colcount; col++)
+                            WriteBinaryColumn(*buffer, stmt, col);
+                    }
+
+                    sqlite3_finalize(stmt);
+
+                    if (deadline.Interrupted())
+                    {
+                        delete buffer;
+                        info.GetVM()->ThrowException("[sqlmodule] Query timed out");
                         return;
                     }
 
-                    auto& objStmt = info.ObjectValue("sqlStmt", nullptr);
+                    info.GetReturnValue().Set(CreateBufferObject(info, buffer));
+                });
 
-                    ret = sqlite3_step(stmt);
+                // querySliced(sql, params, { sliceUs }) runs the statement for at most sliceUs per pulse
+                sqldatabase.SetFunction("querySliced", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
 
-                    for (int col = 0; col < sqlite3_column_count(stmt); col++)
-                    {
-                        std::string colname { sqlite3_column_name(stmt, col) };
+                    sqlite3_stmt* stmt = PrepareStatement(info, db);
+                    if (!stmt)
+                        return;
+
+                    SlicedQuery* query = new SlicedQuery {};
+                    query->db          = db;
+                    query->stmt        = stmt;
+                    query->sliceUs     = SLICED_QUERY_US;
+                    if (info.Length() > 2 && info[2].IsObject() && info[2].ToObject().Get("sliceUs").IsNumber())
+                        query->sliceUs = info[2].ToObject().Get("sliceUs").ToNumber();
+
+                    int timeoutMs = GetTimeoutOption(info, 2);
+                    if (timeoutMs < 0)
+                        timeoutMs = GetDefaultTimeout(db);
+                    if (m_slicedMaxMs && (timeoutMs <= 0 || (uint32_t)timeoutMs > m_slicedMaxMs))
+                        timeoutMs = m_slicedMaxMs;
+                    query->until = timeoutMs > 0 ? std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs) : std::chrono::steady_clock::time_point::max();
+
+                    WriteBinaryHeader(query->rows, stmt);
+                    info.GetReturnValue().Set(CreateSlicedQueryObject(info, query));
+                });
+
+                // queryAsync(sql, params, { priority, timeoutMs }) runs the statement on a worker thread with a read-only
+                // connection of its own, priority is "interactive", "normal" (the default) or "background"
+                sqldatabase.SetFunction("queryAsync", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
 
-                        int coltype = sqlite3_column_type(stmt, col);
-                        switch (sqlite3_column_type(stmt, col))
+                    Priority priority = Priority::Normal;
+                    if (info.Length() > 2 && info[2].IsObject() && info[2].ToObject().Get("priority").IsString())
+                    {
+                        String name = info[2].ToObject().Get("priority").ToString();
+                        if (!ParsePriority(name.c_str(), priority))
                         {
-                        case SQLITE_INTEGER:
-                            objStmt.Set(colname, sqlite3_column_int(stmt, col));
-                            break;
-                        case SQLITE_FLOAT:
-                            objStmt.Set(colname, sqlite3_column_double(stmt, col));
-                            break;
-                        case SQLITE_BLOB:
-                            // not supported, set it to null
-                            objStmt.SetNull(colname);
-                            break;
-                        case SQLITE3_TEXT:
-                            objStmt.Set(colname, sqlite3_column_text(stmt, col));
-                            break;
-                        case SQLITE_NULL:
-                            objStmt.SetNull(colname);
-                            break;
-                        default:
-                            break;
+                            info.GetVM()->ThrowException("[sqlmodule] Unknown priority " + name);
+                            return;
                         }
                     }
 
-                    if (ret == SQLITE_ROW)
-                        info.GetReturnValue().Set(objStmt);
-                    else
-                        info.GetReturnValue().SetNull();
+                    String          error;
+                    ConnectionPool* pool = GetConnectionPool(db, error);
+                    if (!pool)
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] " + error);
+                        return;
+                    }
+
+                    // prepared here as well so errors in the query are thrown right away, the parameters are only
+                    // converted once by CaptureParams
+                    sqlite3_stmt* stmt = PrepareStatement(info, db, false);
+                    if (!stmt)
+                        return;
 
+                    AsyncQuery* query = new AsyncQuery {};
+                    query->db         = db;
+                    query->pool       = pool;
+                    query->sql        = info[0].ToString();
+                    query->references = 2;
+
+                    WriteBinaryHeader(query->rows, stmt);
+                    bool captured = CaptureParams(info, db, stmt, query->params);
                     sqlite3_finalize(stmt);
+                    if (!captured)
+                    {
+                        query->references = 1;
+                        ReleaseAsyncQuery(query);
+                        return;
+                    }
+
+                    int timeoutMs = GetTimeoutOption(info, 2);
+                    if (timeoutMs < 0)
+                        timeoutMs = GetDefaultTimeout(db);
+                    query->until = timeoutMs > 0 ? std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs) : std::chrono::steady_clock::time_point::max();
+
+                    {
+                        std::lock_guard<std::mutex> lock(pool->mutex);
+                        pool->users++;
+                    }
+
+                    auto resource = m_resourceIds.find(info.GetVM());
+                    query->job    = SubmitJob(resource != m_resourceIds.end() ? resource->second : 0, priority, [query] { RunAsyncQuery(query); });
+                    if (!query->job)
+                    {
+                        ReleasePool(pool);
+                        query->references = 1;
+                        ReleaseAsyncQuery(query);
+                        info.GetVM()->ThrowException("[sqlmodule] Too many queued queries");
+                        return;
+                    }
+
+                    info.GetReturnValue().Set(CreateAsyncQueryObject(info, query));
                 });
 
-                sqldatabase.SetFunction("query", [](Scripting::API::ICallbackInfo& info) {
+                sqldatabase.SetFunction("spatialIndex", [](Scripting::API::ICallbackInfo& info) {
                     sqlite3* db = (sqlite3*)info.This().GetInternal();
 
-                    sqlite3_stmt* stmt;
+                    String table     = info[0].ToString();
+                    String idColumn  = info[1].ToString();
+                    String posColumn = info[2].ToString();
 
-                    int ret = sqlite3_prepare_v3(db, info[0].ToString().c_str(), -1, 0, &stmt, 0);
-                    if (ret != SQLITE_OK)
+                    String error;
+                    if (CreateSpatialIndex(db, table, idColumn, posColumn, error) != SQLITE_OK)
                     {
-                        info.GetVM()->ThrowException("[sqlmodule] Error in query: " + String(sqlite3_errmsg(db)));
-                        sqlite3_finalize(stmt);
+                        info.GetVM()->ThrowException("[sqlmodule] Error creating spatial index: " + error);
                         return;
                     }
 
-                    auto& objStmt = info.ObjectValue("SQLite Statement", nullptr);
+                    auto& objIndex = info.ObjectValue("SqlSpatialIndex", db);
+                    {
+                        objIndex.Set("table", table);
+                        objIndex.Set("idColumn", idColumn);
+                        objIndex.Set("posColumn", posColumn);
 
-                    int count {};
-                    while (sqlite3_step(stmt) == SQLITE_ROW)
+                        objIndex.SetFunction("queryNear", [](Scripting::API::ICallbackInfo& info) {
+                            double values[4];
+                            if (!GetVector3(info[0], values) || !info[1].IsNumber())
+                            {
+                                info.GetVM()->ThrowException("[sqlmodule] queryNear expects a position and a radius");
+                                return;
+                            }
+
+                            values[3] = info[1].ToNumber();
+                            QuerySpatialIndex(info, false, values, 4);
+                        });
+
+                        objIndex.SetFunction("queryBox", [](Scripting::API::ICallbackInfo& info) {
+                            double values[6];
+                            if (!GetVector3(info[0], values) || !GetVector3(info[1], values + 3))
+                            {
+                                info.GetVM()->ThrowException("[sqlmodule] queryBox expects a min and a max position");
+                                return;
+                            }
+
+                            QuerySpatialIndex(info, true, values, 6);
+                        });
+
+                        objIndex.SetFunction("rebuild", [](Scripting::API::ICallbackInfo& info) {
+                            auto& index = info.This();
+
+                            String error;
+                            if (RebuildSpatialIndex((sqlite3*)index.GetInternal(), index.Get("table").ToString(), index.Get("idColumn").ToString(), index.Get("posColumn").ToString(), error) != SQLITE_OK)
+                                info.GetVM()->ThrowException("[sqlmodule] Error rebuilding spatial index: " + error);
+                        });
+                    }
+
+                    info.GetReturnValue().Set(objIndex);
+                });
+
+                sqldatabase.SetFunction("fts", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+
+                    String       table   = info[0].ToString();
+                    StringVector columns = GetStringList(info[1]);
+
+                    String error;
+                    if (CreateFtsIndex(db, table, columns, error) != SQLITE_OK)
                     {
-                        auto& objStmt2 = info.ObjectValue("SQLite Statement", nullptr);
+                        info.GetVM()->ThrowException("[sqlmodule] Error creating full-text index: " + error);
+                        return;
+                    }
 
-                        for (int col = 0; col < sqlite3_column_count(stmt); col++)
-                        {
-                            std::string colname { sqlite3_column_name(stmt, col) };
+                    auto& objFts = info.ObjectValue("SqlFts", db);
+                    {
+                        auto& objColumns = info.ObjectValue("SQLite Statement", nullptr);
+                        for (int i = 0; i < (int)columns.size(); i++)
+                            objColumns.Set(i, columns[i]);
+
+                        objFts.Set("table", table);
+                        objFts.Set("columns", objColumns);
 
-                            int coltype = sqlite3_column_type(stmt, col);
-                            switch (sqlite3_column_type(stmt, col))
+                        // search(query, { limit, snippet: true | column }), rows are ordered by bm25 rank (lower is better)
+                        objFts.SetFunction("search", [](Scripting::API::ICallbackInfo& info) {
+                            auto&    fts = info.This();
+                            sqlite3* db  = (sqlite3*)fts.GetInternal();
+
+                            double limit   = -1;
+                            int    snippet = -2;
+                            if (info.Length() > 1 && info[1].IsObject())
                             {
-                            case SQLITE_INTEGER:
-                                objStmt2.Set(colname, sqlite3_column_int(stmt, col));
-                                break;
-                            case SQLITE_FLOAT:
-                                objStmt2.Set(colname, sqlite3_column_double(stmt, col));
-                                break;
-                            case SQLITE_BLOB:
-                                // not supported, set it to null
-                                objStmt2.SetNull(colname);
-                                break;
-                            case SQLITE3_TEXT:
-                                objStmt2.Set(colname, std::string { reinterpret_cast<const char*>(sqlite3_column_text(stmt, col)) });
-                                break;
-                            case SQLITE_NULL:
-                                objStmt2.SetNull(colname);
-                                break;
-                            default:
-                                break;
+                                auto& options = info[1].ToObject();
+                                if (options.Get("limit").IsNumber())
+                                    limit = options.Get("limit").ToNumber();
+
+                                if (options.Get("snippet").IsString())
+                                {
+                                    StringVector columns = GetStringList(fts.Get("columns"));
+                                    String       column  = options.Get("snippet").ToString();
+
+                                    snippet = (int)(std::find(columns.begin(), columns.end(), column) - columns.begin());
+                                    if (snippet == (int)columns.size())
+                                    {
+                                        info.GetVM()->ThrowException("[sqlmodule] Error in search: no such snippet column: " + column);
+                                        return;
+                                    }
+                                }
+                                else if (options.Get("snippet").ToBoolean())
+                                    snippet = -1;
                             }
-                        }
 
-                        objStmt.Set(count, objStmt2);
+                            String sql = GetFtsQuery(fts.Get("table").ToString(), snippet);
+
+                            sqlite3_stmt* stmt;
+                            if (sqlite3_prepare_v3(db, sql.c_str(), -1, 0, &stmt, 0) != SQLITE_OK)
+                            {
+                                info.GetVM()->ThrowException("[sqlmodule] Error in search: " + String(sqlite3_errmsg(db)));
+                                sqlite3_finalize(stmt);
+                                return;
+                            }
+
+                            String query = info[0].ToString();
+                            sqlite3_bind_text(stmt, 1, query.c_str(), (int)query.size(), SQLITE_TRANSIENT);
+                            sqlite3_bind_int64(stmt, 2, (sqlite3_int64)limit);
+
+                            DeadlineScope deadline(db);
+
+                            auto& rows = CollectRows(info, stmt);
+
+                            // an invalid match expression only fails once stepped
+                            int ret = sqlite3_errcode(db);
+                            if (ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW)
+                                info.GetVM()->ThrowException("[sqlmodule] Error in search: " + String(sqlite3_errmsg(db)));
+                            else
+                                info.GetReturnValue().Set(rows);
+
+                            sqlite3_finalize(stmt);
+                        });
+                    }
+
+                    info.GetReturnValue().Set(objFts);
+                });
+
+                // begin(readOnly) starts a transaction, write transactions take the write lock up front with BEGIN IMMEDIATE
+                // a deferred transaction that upgrades later can fail with SQLITE_BUSY without the busy handler ever waiting
+                sqldatabase.SetFunction("begin", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db       = (sqlite3*)info.This().GetInternal();
+                    bool     readOnly = info.Length() > 0 && info[0].ToBoolean();
+
+                    char* errmsg = 0;
+                    sqlite3_exec(db, readOnly ? "BEGIN DEFERRED" : "BEGIN IMMEDIATE", 0, 0, &errmsg);
+                    if (errmsg)
+                        info.GetVM()->ThrowException("[sqlmodule] Error beginning transaction: " + String(errmsg));
+                    sqlite3_free(errmsg);
+                });
+
+                sqldatabase.SetFunction("commit", [](Scripting::API::ICallbackInfo& info) {
+                    char* errmsg = 0;
+                    sqlite3_exec((sqlite3*)info.This().GetInternal(), "COMMIT", 0, 0, &errmsg);
+                    if (errmsg)
+                        info.GetVM()->ThrowException("[sqlmodule] Error committing: " + String(errmsg));
+                    sqlite3_free(errmsg);
+                });
+
+                sqldatabase.SetFunction("rollback", [](Scripting::API::ICallbackInfo& info) {
+                    char* errmsg = 0;
+                    sqlite3_exec((sqlite3*)info.This().GetInternal(), "ROLLBACK", 0, 0, &errmsg);
+                    if (errmsg)
+                        info.GetVM()->ThrowException("[sqlmodule] Error rolling back: " + String(errmsg));
+                    sqlite3_free(errmsg);
+                });
+
+                // setTimeout(ms) limits how long any single call on this connection may run, 0 removes the limit
+                sqldatabase.SetFunction("setTimeout", [](Scripting::API::ICallbackInfo& info) {
+                    SetDefaultTimeout((sqlite3*)info.This().GetInternal(), (int)info[0].ToNumber());
+                });
+
+                // stats(reset) returns the page cache, lookaside and lock wait counters of this connection
+                sqldatabase.SetFunction("stats", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db    = (sqlite3*)info.This().GetInternal();
+                    bool     reset = info.Length() > 0 && info[0].ToBoolean();
+
+                    static const Pair<const char*, int> counters[] = {
+                        { "cacheUsed", SQLITE_DBSTATUS_CACHE_USED },
+                        { "cacheHit", SQLITE_DBSTATUS_CACHE_HIT },
+                        { "cacheMiss", SQLITE_DBSTATUS_CACHE_MISS },
+                        { "cacheWrite", SQLITE_DBSTATUS_CACHE_WRITE },
+                        { "cacheSpill", SQLITE_DBSTATUS_CACHE_SPILL },
+                        { "lookasideUsed", SQLITE_DBSTATUS_LOOKASIDE_USED },
+                        { "lookasideHit", SQLITE_DBSTATUS_LOOKASIDE_HIT },
+                        { "lookasideMissSize", SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE },
+                        { "lookasideMissFull", SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL },
+                        { "schemaUsed", SQLITE_DBSTATUS_SCHEMA_USED },
+                        { "stmtUsed", SQLITE_DBSTATUS_STMT_USED },
+                    };
+
+                    auto& objStats = info.ObjectValue("SqlDatabaseStats", nullptr);
+                    for (auto& [name, op] : counters)
+                    {
+                        int current   = 0;
+                        int highwater = 0;
+                        sqlite3_db_status(db, op, &current, &highwater, reset);
+
+                        // lookaside hits and misses are reported as highwater, the current value is always 0
+                        objStats.Set(name, op == SQLITE_DBSTATUS_LOOKASIDE_HIT || op == SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE || op == SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL ? highwater : current);
+                    }
+
+                    BusyStats busy;
+                    if (GetBusyStats(db, busy, reset))
+                    {
+                        auto& objBusy    = info.ObjectValue("SqlDatabaseStats", nullptr);
+                        auto& objBuckets = info.ObjectValue("SqlDatabaseStats", nullptr);
+
+                        objBusy.Set("waits", (double)busy.waits);
+                        objBusy.Set("retries", (double)busy.retries);
+                        objBusy.Set("timeouts", (double)busy.timeouts);
+                        objBusy.Set("totalUs", (double)busy.totalUs);
+                        objBusy.Set("maxUs", (double)busy.maxUs);
+                        for (int i = 0; i < BUSY_HISTOGRAM_BUCKETS; i++)
+                            objBuckets.Set(i, (double)busy.histogram[i]);
+                        objBusy.Set("histogram", objBuckets);
+
+                        objStats.Set("busy", objBusy);
+                    }
+
+                    info.GetReturnValue().Set(objStats);
+                });
+
+                // snapshot(wait) copies a database opened with persistTo to its file now instead of at the next interval
+                sqldatabase.SetFunction("snapshot", [](Scripting::API::ICallbackInfo& info) {
+                    String error;
+                    if (!Snapshot((sqlite3*)info.This().GetInternal(), info.Length() > 0 && info[0].ToBoolean(), error))
+                        info.GetVM()->ThrowException("[sqlmodule] Error writing snapshot: " + error);
+                });
+
+                // trackChanges(tables) records the changes made to tables (all if omitted) from now on
+                sqldatabase.SetFunction("trackChanges", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3*     db     = (sqlite3*)info.This().GetInternal();
+                    StringVector tables = info.Length() > 0 ? GetStringList(info[0]) : StringVector {};
+
+                    String   error;
+                    Session* session = CreateSession(db, tables, error);
+                    if (!session)
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] Error tracking changes: " + error);
+                        return;
+                    }
+
+                    auto& objSession = info.ObjectValue("SqlSession", session);
+                    {
+                        // changeset(reset) returns the changes recorded so far or null if there are none,
+                        // with reset the next changeset only contains what changed after this call
+                        objSession.SetFunction("changeset", [](Scripting::API::ICallbackInfo& info) {
+                            Session* session = (Session*)info.This().GetInternal();
+                            if (!IsSession(session))
+                            {
+                                info.GetVM()->ThrowException("[sqlmodule] Session was already freed");
+                                return;
+                            }
+
+                            Buffer* changeset = new Buffer;
+                            String  error;
+                            if (!GetChangeset(session, info.Length() > 0 && info[0].ToBoolean(), *changeset, error))
+                            {
+                                delete changeset;
+                                info.GetVM()->ThrowException("[sqlmodule] Error creating changeset: " + error);
+                                return;
+                            }
+
+                            if (changeset->empty())
+                            {
+                                delete changeset;
+                                info.GetReturnValue().SetNull();
+                                return;
+                            }
+
+                            info.GetReturnValue().Set(CreateChangesetObject(info, changeset));
+                        });
+
+                        objSession.SetFunction("free", [](Scripting::API::ICallbackInfo& info) {
+                            DeleteSession((Session*)info.This().GetInternal());
+                        });
+                    }
+
+                    info.GetReturnValue().Set(objSession);
+                });
+
+                // loadChangeset(sql, params) turns a blob stored from a changeset back into one
+                sqldatabase.SetFunction("loadChangeset", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+
+                    sqlite3_stmt* stmt = PrepareStatement(info, db);
+                    if (!stmt)
+                        return;
 
-                        count++;
+                    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) == SQLITE_BLOB)
+                    {
+                        const uint8_t* data      = (const uint8_t*)sqlite3_column_blob(stmt, 0);
+                        Buffer*        changeset = new Buffer(data, data + sqlite3_column_bytes(stmt, 0));
+                        info.GetReturnValue().Set(CreateChangesetObject(info, changeset));
                     }
+                    else
+                        info.GetReturnValue().SetNull();
 
                     sqlite3_finalize(stmt);
+                });
 
-                    info.GetReturnValue().Set(objStmt);
+                // backup(path, { pagesPerStep, maxMsPerPulse, maxRestarts, maxAgeMs }) copies the database into path over the
+                // next pulses
+                sqldatabase.SetFunction("backup", [](Scripting::API::ICallbackInfo& info) {
+                    sqlite3* db            = (sqlite3*)info.This().GetInternal();
+                    String   path          = info[0].ToString();
+                    int      pagesPerStep  = 0;
+                    double   maxMsPerPulse = m_backupSliceUs / 1000.0;
+                    int      maxRestarts   = BACKUP_MAX_RESTARTS;
+                    int      maxAgeMs      = 0;
+                    if (info.Length() > 1 && info[1].IsObject())
+                    {
+                        auto& options = info[1].ToObject();
+                        if (options.Get("pagesPerStep").IsNumber())
+                            pagesPerStep = options.Get("pagesPerStep").ToNumber();
+                        if (options.Get("maxMsPerPulse").IsNumber())
+                            maxMsPerPulse = options.Get("maxMsPerPulse").ToNumber();
+                        if (options.Get("maxRestarts").IsNumber())
+                            maxRestarts = options.Get("maxRestarts").ToNumber();
+                        if (options.Get("maxAgeMs").IsNumber())
+                            maxAgeMs = options.Get("maxAgeMs").ToNumber();
+                    }
+
+                    String     error;
+                    BackupJob* job = StartBackup(db, path, pagesPerStep, (int)(maxMsPerPulse * 1000), maxRestarts, maxAgeMs, error);
+                    if (!job)
+                    {
+                        info.GetVM()->ThrowException("[sqlmodule] Error starting backup: " + error);
+                        return;
+                    }
+
+                    auto& objBackup = info.ObjectValue("SqlBackup", job);
+                    {
+                        objBackup.SetFunction("progress", [](Scripting::API::ICallbackInfo& info) {
+                            BackupProgress progress;
+                            if (!GetBackupProgress((BackupJob*)info.This().GetInternal(), progress))
+                            {
+                                info.GetVM()->ThrowException("[sqlmodule] Backup was already freed");
+                                return;
+                            }
+
+                            auto& objProgress = info.ObjectValue("SqlBackupProgress", nullptr);
+                            objProgress.Set("pageCount", progress.pageCount);
+                            objProgress.Set("remaining", progress.remaining);
+                            objProgress.Set("restarts", progress.restarts);
+                            objProgress.Set("done", progress.done);
+                            if (!progress.error.empty())
+                                objProgress.Set("error", progress.error);
+                            else
+                                objProgress.SetNull("error");
+
+                            info.GetReturnValue().Set(objProgress);
+                        });
+
+                        objBackup.SetFunction("free", [](Scripting::API::ICallbackInfo& info) {
+                            FreeBackup((BackupJob*)info.This().GetInternal());
+                        });
+                    }
+
+                    info.GetReturnValue().Set(objBackup);
                 });
 
                 sqldatabase.SetFunction("close", [](Scripting::API::ICallbackInfo& info) {
-                    sqlite3_close_v2((sqlite3*)info.This().GetInternal());
+                    sqlite3* db = (sqlite3*)info.This().GetInternal();
+                    if (!m_databases.erase(db))
+                        return;
+
+                    DisableSnapshots(db);
+                    CancelBackups(db);
+                    DeleteSessions(db);
+                    FinishSlicedQueries(db, "database was closed");
+                    FinishAsyncQueries(db, "database was closed");
+                    DisableDeadlines(db);
+                    DisableBusyHandler(db);
+                    UntrackDatabase(db);
+                    if (!CloseImage(db))
+                        sqlite3_close_v2(db);
                 });
             }
 
             info.GetReturnValue().Set(sqldatabase);
         });
 
+        // sqlite3_io_stats(reset) returns the counters of files opened through the "stats" VFS
+        vm->RegisterGlobalFunction("sqlite3_io_stats", [](Scripting::API::ICallbackInfo& info) {
+            bool reset = info.Length() > 0 && info[0].ToBoolean();
+
+            auto& objStats = info.ObjectValue("SqlIoStats", nullptr);
+            for (auto& [filename, file] : GetIoStats(reset))
+            {
+                auto& objFile = info.ObjectValue("SqlIoStats", nullptr);
+                for (int op = 0; op < IO_OPERATION_COUNT; op++)
+                {
+                    auto& stats      = file[op];
+                    auto& objOp      = info.ObjectValue("SqlIoStats", nullptr);
+                    auto& objBuckets = info.ObjectValue("SqlIoStats", nullptr);
+
+                    objOp.Set("count", (double)stats.count);
+                    objOp.Set("bytes", (double)stats.bytes);
+                    objOp.Set("totalUs", (double)stats.totalUs);
+                    objOp.Set("maxUs", (double)stats.maxUs);
+                    for (int i = 0; i < IO_HISTOGRAM_BUCKETS; i++)
+                        objBuckets.Set(i, (double)stats.histogram[i]);
+                    objOp.Set("histogram", objBuckets);
+
+                    objFile.Set(GetIoOperationName(op), objOp);
+                }
+                objStats.Set(filename, objFile);
+            }
+
+            info.GetReturnValue().Set(objStats);
+        });
+
+        // sqlite3_async_stats(reset) returns the queue depth and wait times of every priority and the load of every resource
+        vm->RegisterGlobalFunction("sqlite3_async_stats", [](Scripting::API::ICallbackInfo& info) {
+            bool reset = info.Length() > 0 && info[0].ToBoolean();
+
+            QueueStats queues[PRIORITY_COUNT];
+            GetQueueStats(queues, reset);
+
+            auto& objStats = info.ObjectValue("SqlAsyncStats", nullptr);
+            for (int i = 0; i < PRIORITY_COUNT; i++)
+            {
+                auto& objQueue = info.ObjectValue("SqlAsyncStats", nullptr);
+                objQueue.Set("depth", (double)queues[i].depth);
+                objQueue.Set("started", (double)queues[i].started);
+                objQueue.Set("totalWaitUs", (double)queues[i].totalWaitUs);
+                objQueue.Set("maxWaitUs", (double)queues[i].maxWaitUs);
+                objStats.Set(GetPriorityName((Priority)i), objQueue);
+            }
+
+            // keyed by SQLITE_RESOURCE_ID of the submitting script
+            auto& objResources = info.ObjectValue("SqlAsyncStats", nullptr);
+            for (auto& [id, resource] : GetResourceStats(reset))
+            {
+                auto& objResource = info.ObjectValue("SqlAsyncStats", nullptr);
+                objResource.Set("queued", (double)resource.queued);
+                objResource.Set("running", (double)resource.running);
+                objResource.Set("completed", (double)resource.completed);
+                objResource.Set("rejected", (double)resource.rejected);
+                objResource.Set("dbTimeUs", (double)resource.dbTimeUs);
+                objResources.Set(id, objResource);
+            }
+            objStats.Set("resources", objResources);
+
+            info.GetReturnValue().Set(objStats);
+        });
+
+        // sqlite3_memory_stats() returns SQLite's heap usage and the counters of the pool allocator
+        vm->RegisterGlobalFunction("sqlite3_memory_stats", [](Scripting::API::ICallbackInfo& info) {
+            auto& objStats = info.ObjectValue("SqlMemoryStats", nullptr);
+            objStats.Set("used", (double)sqlite3_memory_used());
+            objStats.Set("highwater", (double)sqlite3_memory_highwater(0));
+            objStats.Set("budget", (double)GetMemoryBudget());
+            objStats.Set("softLimit", (double)sqlite3_soft_heap_limit64(-1));
+
+            sqlite3_int64 current   = 0;
+            sqlite3_int64 highwater = 0;
+
+            auto& objPageCache = info.ObjectValue("SqlMemoryStats", nullptr);
+            sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &current, &highwater, 0);
+            objPageCache.Set("used", (double)current);
+            objPageCache.Set("usedHighwater", (double)highwater);
+            sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &current, &highwater, 0);
+            objPageCache.Set("overflow", (double)current);
+            objPageCache.Set("overflowHighwater", (double)highwater);
+            sqlite3_status64(SQLITE_STATUS_PAGECACHE_SIZE, &current, &highwater, 0);
+            objPageCache.Set("largestPage", (double)highwater);
+            objStats.Set("pageCache", objPageCache);
+
+            if (IsPoolAllocatorInstalled())
+            {
+                AllocatorStats stats = GetAllocatorStats();
+
+                auto& objPools = info.ObjectValue("SqlMemoryStats", nullptr);
+                for (size_t i = 0; i < stats.pools.size(); i++)
+                {
+                    auto& pool    = stats.pools[i];
+                    auto& objPool = info.ObjectValue("SqlMemoryStats", nullptr);
+                    objPool.Set("size", (int)pool.size);
+                    objPool.Set("allocations", (double)pool.allocations);
+                    objPool.Set("inUse", (double)pool.inUse);
+                    objPool.Set("cached", (double)pool.cached);
+                    objPools.Set((int)i, objPool);
+                }
+                objStats.Set("pools", objPools);
+
+                auto& objLarge = info.ObjectValue("SqlMemoryStats", nullptr);
+                objLarge.Set("allocations", (double)stats.largeAllocations);
+                objLarge.Set("inUse", (double)stats.largeInUse);
+                objLarge.Set("bytes", (double)stats.largeBytes);
+                objStats.Set("large", objLarge);
+                objStats.Set("arenaBytes", (double)stats.arenaBytes);
+                objStats.Set("retainedBytes", (double)stats.retainedBytes);
+            }
+
+            info.GetReturnValue().Set(objStats);
+        });
+
+#ifdef SQLMODULE_LATENCY_VFS
+        // sqlite3_latency_stats(reset) returns how long the main thread spent in the latency VFS per pulse
+        vm->RegisterGlobalFunction("sqlite3_latency_stats", [](Scripting::API::ICallbackInfo& info) {
+            LatencyStats stats;
+            GetLatencyStats(stats, info.Length() > 0 && info[0].ToBoolean());
+
+            auto& objStats   = info.ObjectValue("SqlLatencyStats", nullptr);
+            auto& objBuckets = info.ObjectValue("SqlLatencyStats", nullptr);
+
+            objStats.Set("pulses", (double)stats.pulses);
+            objStats.Set("totalUs", (double)stats.totalUs);
+            objStats.Set("maxUs", (double)stats.maxUs);
+            for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+                objBuckets.Set(i, (double)stats.histogram[i]);
+            objStats.Set("histogram", objBuckets);
+
+            info.GetReturnValue().Set(objStats);
+        });
+#endif
+
+        vm->RegisterGlobalFunction("sqlite3_buffer", [](Scripting::API::ICallbackInfo& info) {
+            if (info.Length() < 1 || !info[0].IsString())
+            {
+                info.GetVM()->ThrowException("[sqlmodule] sqlite3_buffer needs a base64 string");
+                return;
+            }
+
+            Buffer* buffer = new Buffer;
+            if (!DecodeBase64(info[0].ToString(), *buffer))
+            {
+                delete buffer;
+                info.GetVM()->ThrowException("[sqlmodule] Error creating buffer: invalid base64");
+                return;
+            }
+
+            info.GetReturnValue().Set(CreateBufferObject(info, buffer));
+        });
+
         vm->RegisterGlobalFunction("sqlite3_escape", [](Scripting::API::ICallbackInfo& info) {
             String str = sqlite3_mprintf("%q", info[0].ToString().c_str());
             info.GetReturnValue().Set(str);
@@ -184,5 +2628,15 @@ namespace module
 
     DLLEXPORT void OnPulse()
     {
+        // the memory share follows the player count, it stays as it is while the server API isn't available
+        auto server = m_api->GetServerAPI();
+        if (server)
+            RebalanceMemory(server->GetPlayerCount(), server->GetMaxPlayers());
+        StepBackups(m_backupSliceUs);
+        StepSlicedQueries();
+
+#ifdef SQLMODULE_LATENCY_VFS
+        EndLatencyPulse();
+#endif
     }
 } // namespace module
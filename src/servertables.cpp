@@ -0,0 +1,289 @@
+#include "servertables.hpp"
+
+#include <thread>
+
+namespace module
+{
+    enum ServerInfoColumn
+    {
+        INFO_NAME,
+        INFO_PORT,
+        INFO_PLAYER_COUNT,
+        INFO_MAX_PLAYERS,
+        INFO_GAME,
+        INFO_PASSWORDED,
+        INFO_GAMEMODE,
+        INFO_VERSION
+    };
+
+    enum ServerPlayersColumn
+    {
+        PLAYERS_ID,
+        PLAYERS_NAME
+    };
+
+    struct ServerTableInfo
+    {
+        Universe::ModuleAPI::IServerAPI* server;
+        bool                             players;
+
+        // IServerAPI isn't thread-safe, scans are only allowed on the thread that opened the connection
+        std::thread::id mainThread;
+    };
+
+    struct ServerTable : sqlite3_vtab
+    {
+        ServerTableInfo* info;
+    };
+
+    struct ServerInfo
+    {
+        Universe::String name;
+        uint32_t         port;
+        uint8_t          playerCount;
+        uint8_t          maxPlayers;
+        uint8_t          game;
+        bool             passworded;
+        Universe::String gamemode;
+        Universe::String version;
+    };
+
+    struct ServerCursor : sqlite3_vtab_cursor
+    {
+        // the server is read once per scan in xFilter so a scan sees a consistent state
+        Universe::Vector<Universe::Pair<uint32_t, Universe::String>> rows;
+        size_t                                                       row;
+        ServerInfo                                                   serverInfo;
+    };
+
+    static int ServerConnect(sqlite3* db, void* aux, int, const char* const*, sqlite3_vtab** vtab, char**)
+    {
+        auto* info = (ServerTableInfo*)aux;
+
+        int ret = sqlite3_declare_vtab(db, info->players ? "CREATE TABLE x(id INTEGER, name TEXT)"
+                                                         : "CREATE TABLE x(name TEXT, port INTEGER, player_count INTEGER, max_players INTEGER, game INTEGER, passworded INTEGER, gamemode TEXT, version TEXT)");
+        if (ret != SQLITE_OK)
+            return ret;
+
+        auto* table = new ServerTable {};
+        table->info = info;
+        *vtab       = table;
+
+        sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+        return SQLITE_OK;
+    }
+
+    static int ServerDisconnect(sqlite3_vtab* vtab)
+    {
+        delete (ServerTable*)vtab;
+        return SQLITE_OK;
+    }
+
+    // idxNum 1: server_players lookup by id (used when joining on the client index)
+    static int ServerBestIndex(sqlite3_vtab* vtab, sqlite3_index_info* index)
+    {
+        auto* table = (ServerTable*)vtab;
+
+        index->estimatedCost = table->info->players ? 100.0 : 1.0;
+        index->estimatedRows = table->info->players ? 100 : 1;
+
+        if (!table->info->players)
+            return SQLITE_OK;
+
+        for (int i = 0; i < index->nConstraint; i++)
+        {
+            auto& constraint = index->aConstraint[i];
+            if (constraint.usable && constraint.iColumn == PLAYERS_ID && constraint.op == SQLITE_INDEX_CONSTRAINT_EQ)
+            {
+                index->idxNum                        = 1;
+                index->aConstraintUsage[i].argvIndex = 1;
+                index->aConstraintUsage[i].omit      = 1;
+                index->estimatedCost                 = 1.0;
+                index->estimatedRows                 = 1;
+                index->idxFlags                      = SQLITE_INDEX_SCAN_UNIQUE;
+                break;
+            }
+        }
+
+        return SQLITE_OK;
+    }
+
+    static int ServerOpen(sqlite3_vtab*, sqlite3_vtab_cursor** cursor)
+    {
+        *cursor = new ServerCursor {};
+        return SQLITE_OK;
+    }
+
+    static int ServerClose(sqlite3_vtab_cursor* cursor)
+    {
+        delete (ServerCursor*)cursor;
+        return SQLITE_OK;
+    }
+
+    static int ServerFilter(sqlite3_vtab_cursor* vcursor, int idxNum, const char*, int, sqlite3_value** argv)
+    {
+        auto* cursor = (ServerCursor*)vcursor;
+        auto* info   = ((ServerTable*)vcursor->pVtab)->info;
+
+        cursor->rows.clear();
+        cursor->row = 0;
+
+        if (std::this_thread::get_id() != info->mainThread)
+        {
+            sqlite3_free(vcursor->pVtab->zErrMsg);
+            vcursor->pVtab->zErrMsg = sqlite3_mprintf("server tables can only be read on the main thread");
+            return SQLITE_MISUSE;
+        }
+
+        if (!info->players)
+        {
+            auto* server       = info->server;
+            cursor->serverInfo = ServerInfo { server->GetName(), server->GetPort(), server->GetPlayerCount(), server->GetMaxPlayers(),
+                                              server->GetGame(), server->IsPassworded(), server->GetGamemode(), server->GetVersion() };
+            cursor->rows.emplace_back();
+            return SQLITE_OK;
+        }
+
+        uint32_t maxPlayers = info->server->GetMaxPlayers();
+        if (idxNum == 1)
+        {
+            sqlite3_int64 id = sqlite3_value_int64(argv[0]);
+            if (sqlite3_value_type(argv[0]) != SQLITE_INTEGER || id < 0 || id >= maxPlayers)
+                return SQLITE_OK;
+
+            Universe::String name = info->server->GetClientName((uint32_t)id);
+            if (!name.empty())
+                cursor->rows.emplace_back((uint32_t)id, std::move(name));
+
+            return SQLITE_OK;
+        }
+
+        // slots aren't necessarily contiguous, empty names are free slots
+        for (uint32_t id = 0; id < maxPlayers; id++)
+        {
+            Universe::String name = info->server->GetClientName(id);
+            if (!name.empty())
+                cursor->rows.emplace_back(id, std::move(name));
+        }
+
+        return SQLITE_OK;
+    }
+
+    static int ServerNext(sqlite3_vtab_cursor* cursor)
+    {
+        ((ServerCursor*)cursor)->row++;
+        return SQLITE_OK;
+    }
+
+    static int ServerEof(sqlite3_vtab_cursor* vcursor)
+    {
+        auto* cursor = (ServerCursor*)vcursor;
+        return cursor->row >= cursor->rows.size();
+    }
+
+    static void ResultString(sqlite3_context* ctx, const Universe::String& str)
+    {
+        sqlite3_result_text(ctx, str.c_str(), (int)str.size(), SQLITE_TRANSIENT);
+    }
+
+    static int ServerColumn(sqlite3_vtab_cursor* vcursor, sqlite3_context* ctx, int col)
+    {
+        auto* cursor = (ServerCursor*)vcursor;
+        auto* info   = ((ServerTable*)vcursor->pVtab)->info;
+
+        if (info->players)
+        {
+            auto& row = cursor->rows[cursor->row];
+            if (col == PLAYERS_ID)
+                sqlite3_result_int64(ctx, row.first);
+            else
+                ResultString(ctx, row.second);
+            return SQLITE_OK;
+        }
+
+        auto& server = cursor->serverInfo;
+        switch (col)
+        {
+        case INFO_NAME:
+            ResultString(ctx, server.name);
+            break;
+        case INFO_PORT:
+            sqlite3_result_int64(ctx, server.port);
+            break;
+        case INFO_PLAYER_COUNT:
+            sqlite3_result_int(ctx, server.playerCount);
+            break;
+        case INFO_MAX_PLAYERS:
+            sqlite3_result_int(ctx, server.maxPlayers);
+            break;
+        case INFO_GAME:
+            sqlite3_result_int(ctx, server.game);
+            break;
+        case INFO_PASSWORDED:
+            sqlite3_result_int(ctx, server.passworded);
+            break;
+        case INFO_GAMEMODE:
+            ResultString(ctx, server.gamemode);
+            break;
+        case INFO_VERSION:
+            ResultString(ctx, server.version);
+            break;
+        default:
+            break;
+        }
+
+        return SQLITE_OK;
+    }
+
+    static int ServerRowid(sqlite3_vtab_cursor* vcursor, sqlite3_int64* rowid)
+    {
+        auto* cursor = (ServerCursor*)vcursor;
+        *rowid       = cursor->rows[cursor->row].first;
+        return SQLITE_OK;
+    }
+
+    // xCreate is null which makes the tables eponymous-only, they can't be created or written to
+    static sqlite3_module s_serverModule = {
+        0,                // iVersion
+        nullptr,          // xCreate
+        ServerConnect,    // xConnect
+        ServerBestIndex,  // xBestIndex
+        ServerDisconnect, // xDisconnect
+        nullptr,          // xDestroy
+        ServerOpen,       // xOpen
+        ServerClose,      // xClose
+        ServerFilter,     // xFilter
+        ServerNext,       // xNext
+        ServerEof,        // xEof
+        ServerColumn,     // xColumn
+        ServerRowid,      // xRowid
+        nullptr,          // xUpdate
+        nullptr,          // xBegin
+        nullptr,          // xSync
+        nullptr,          // xCommit
+        nullptr,          // xRollback
+        nullptr,          // xFindFunction
+        nullptr,          // xRename
+        nullptr,          // xSavepoint
+        nullptr,          // xRelease
+        nullptr,          // xRollbackTo
+        nullptr,          // xShadowName
+    };
+
+    static void FreeTableInfo(void* info)
+    {
+        delete (ServerTableInfo*)info;
+    }
+
+    int RegisterServerTables(sqlite3* db, Universe::ModuleAPI::IServerAPI* server)
+    {
+        if (!server)
+            return SQLITE_OK;
+
+        int ret = sqlite3_create_module_v2(db, "server_players", &s_serverModule, new ServerTableInfo { server, true, std::this_thread::get_id() }, FreeTableInfo);
+        if (ret != SQLITE_OK)
+            return ret;
+
+        return sqlite3_create_module_v2(db, "server_info", &s_serverModule, new ServerTableInfo { server, false, std::this_thread::get_id() }, FreeTableInfo);
+    }
+} // namespace module
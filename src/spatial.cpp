@@ -0,0 +1,282 @@
+#include "spatial.hpp"
+
+#include "blobtypes.hpp"
+#include "sqlutil.hpp"
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SQLMODULE_SSE 1
+#endif
+
+namespace module
+{
+    // loads the blob into x, y, z, 0 lanes; the blob is only 12 bytes so it goes through a padded copy
+    static bool LoadVector3(sqlite3_value* value, float out[4])
+    {
+        if (sqlite3_value_type(value) != SQLITE_BLOB || sqlite3_value_bytes(value) != VECTOR3_SIZE)
+            return false;
+
+        memcpy(out, sqlite3_value_blob(value), VECTOR3_SIZE);
+        out[3] = 0.0f;
+        return true;
+    }
+
+    static bool LoadVector3(sqlite3_value** argv, float out[4])
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (sqlite3_value_type(argv[i]) == SQLITE_NULL)
+                return false;
+
+            out[i] = (float)sqlite3_value_double(argv[i]);
+        }
+        out[3] = 0.0f;
+        return true;
+    }
+
+    static float DistanceSqr(const float a[4], const float b[4])
+    {
+#ifdef SQLMODULE_SSE
+        __m128 d  = _mm_sub_ps(_mm_loadu_ps(a), _mm_loadu_ps(b));
+        __m128 sq = _mm_mul_ps(d, d);
+        __m128 hi = _mm_movehl_ps(sq, sq);
+        __m128 s  = _mm_add_ps(sq, hi);
+        s         = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+#else
+        float x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2], w = a[3] - b[3];
+        return x * x + y * y + z * z + w * w;
+#endif
+    }
+
+    static bool Contains(const float point[4], const float min[4], const float max[4])
+    {
+#ifdef SQLMODULE_SSE
+        __m128 p    = _mm_loadu_ps(point);
+        int    mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(p, _mm_loadu_ps(min)), _mm_cmple_ps(p, _mm_loadu_ps(max))));
+        return (mask & 0x7) == 0x7;
+#else
+        return point[0] >= min[0] && point[0] <= max[0] && point[1] >= min[1] && point[1] <= max[1] && point[2] >= min[2] && point[2] <= max[2];
+#endif
+    }
+
+    // vec3_dist(pos, x, y, z) or vec3_dist(pos, pos)
+    static void Vec3Dist(sqlite3_context* ctx, int argc, sqlite3_value** argv)
+    {
+        float a[4], b[4];
+        if (!LoadVector3(argv[0], a) || !(argc == 2 ? LoadVector3(argv[1], b) : LoadVector3(argv + 1, b)))
+        {
+            sqlite3_result_null(ctx);
+            return;
+        }
+
+        sqlite3_result_double(ctx, std::sqrt(DistanceSqr(a, b)));
+    }
+
+    // vec3_within(pos, x, y, z, radius)
+    static void Vec3Within(sqlite3_context* ctx, int, sqlite3_value** argv)
+    {
+        float a[4], b[4];
+        if (!LoadVector3(argv[0], a) || !LoadVector3(argv + 1, b))
+        {
+            sqlite3_result_null(ctx);
+            return;
+        }
+
+        float radius = (float)sqlite3_value_double(argv[4]);
+        sqlite3_result_int(ctx, DistanceSqr(a, b) <= radius * radius);
+    }
+
+    // vec2_dist(pos, x, y)
+    static void Vec2Dist(sqlite3_context* ctx, int, sqlite3_value** argv)
+    {
+        if (sqlite3_value_type(argv[0]) != SQLITE_BLOB || sqlite3_value_bytes(argv[0]) != VECTOR2_SIZE || sqlite3_value_type(argv[1]) == SQLITE_NULL || sqlite3_value_type(argv[2]) == SQLITE_NULL)
+        {
+            sqlite3_result_null(ctx);
+            return;
+        }
+
+        auto vec = UnpackVector2(sqlite3_value_blob(argv[0]));
+        sqlite3_result_double(ctx, Universe::Math::Vector2::Distance2D(vec, Universe::Math::Vector2((float)sqlite3_value_double(argv[1]), (float)sqlite3_value_double(argv[2]))));
+    }
+
+    // aabb_contains(pos, minX, minY, minZ, maxX, maxY, maxZ)
+    static void AabbContains(sqlite3_context* ctx, int, sqlite3_value** argv)
+    {
+        float p[4], min[4], max[4];
+        if (!LoadVector3(argv[0], p) || !LoadVector3(argv + 1, min) || !LoadVector3(argv + 4, max))
+        {
+            sqlite3_result_null(ctx);
+            return;
+        }
+
+        sqlite3_result_int(ctx, Contains(p, min, max));
+    }
+
+    // vec3_x(pos), vec3_y(pos), vec3_z(pos), the component is passed as user data
+    static void Vec3Component(sqlite3_context* ctx, int, sqlite3_value** argv)
+    {
+        float v[4];
+        if (!LoadVector3(argv[0], v))
+        {
+            sqlite3_result_null(ctx);
+            return;
+        }
+
+        sqlite3_result_double(ctx, v[(intptr_t)sqlite3_user_data(ctx)]);
+    }
+
+    int RegisterSpatialFunctions(sqlite3* db)
+    {
+        struct
+        {
+            const char* name;
+            int         argc;
+            void (*func)(sqlite3_context*, int, sqlite3_value**);
+            intptr_t data;
+        } functions[] = {
+            { "vec3_dist", 4, Vec3Dist, 0 },
+            { "vec3_dist", 2, Vec3Dist, 0 },
+            { "vec3_within", 5, Vec3Within, 0 },
+            { "vec2_dist", 3, Vec2Dist, 0 },
+            { "aabb_contains", 7, AabbContains, 0 },
+            { "vec3_x", 1, Vec3Component, 0 },
+            { "vec3_y", 1, Vec3Component, 1 },
+            { "vec3_z", 1, Vec3Component, 2 },
+        };
+
+        // innocuous so the functions can be used by the spatial index triggers
+        for (auto& function : functions)
+        {
+            int ret = sqlite3_create_function_v2(db, function.name, function.argc, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, (void*)function.data, function.func, nullptr, nullptr, nullptr);
+            if (ret != SQLITE_OK)
+                return ret;
+        }
+
+        return SQLITE_OK;
+    }
+
+    static std::string GetBounds(const std::string& pos)
+    {
+        return "vec3_x(" + pos + "), vec3_x(" + pos + "), vec3_y(" + pos + "), vec3_y(" + pos + "), vec3_z(" + pos + "), vec3_z(" + pos + ")";
+    }
+
+    std::string GetSpatialIndexName(const std::string& table)
+    {
+        return table + "_rtree";
+    }
+
+    // the triggers keeping the index of table in sync, by name; they name both columns, so an existing index was
+    // created for the same ones if its triggers are the same
+    static std::vector<std::pair<std::string, std::string>> GetSpatialTriggers(const std::string& table, const std::string& idColumn, const std::string& posColumn)
+    {
+        std::string index = GetSpatialIndexName(table);
+        std::string idx   = QuoteIdentifier(index);
+        std::string tbl   = QuoteIdentifier(table);
+        std::string id    = QuoteIdentifier(idColumn);
+        std::string pos   = QuoteIdentifier(posColumn);
+
+        return {
+            { index + "_insert", "CREATE TRIGGER " + QuoteIdentifier(index + "_insert") + " AFTER INSERT ON " + tbl + " WHEN vec3_x(NEW." + pos + ") IS NOT NULL BEGIN "
+                                 "INSERT OR REPLACE INTO " + idx + " VALUES (NEW." + id + ", " + GetBounds("NEW." + pos) + "); END" },
+            { index + "_update", "CREATE TRIGGER " + QuoteIdentifier(index + "_update") + " AFTER UPDATE OF " + id + ", " + pos + " ON " + tbl + " BEGIN "
+                                 "DELETE FROM " + idx + " WHERE id = OLD." + id + ";"
+                                 "INSERT INTO " + idx + " SELECT NEW." + id + ", " + GetBounds("NEW." + pos) + " WHERE vec3_x(NEW." + pos + ") IS NOT NULL; END" },
+            { index + "_delete", "CREATE TRIGGER " + QuoteIdentifier(index + "_delete") + " AFTER DELETE ON " + tbl + " BEGIN "
+                                 "DELETE FROM " + idx + " WHERE id = OLD." + id + "; END" },
+        };
+    }
+
+    static bool TriggerMatches(sqlite3* db, const std::string& name, const std::string& sql)
+    {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT sql FROM sqlite_master WHERE type = 'trigger' AND name = ?", -1, &stmt, 0) != SQLITE_OK)
+            return false;
+
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        bool matches = sqlite3_step(stmt) == SQLITE_ROW && sql == (const char*)sqlite3_column_text(stmt, 0);
+        sqlite3_finalize(stmt);
+
+        return matches;
+    }
+
+    int CreateSpatialIndex(sqlite3* db, const std::string& table, const std::string& idColumn, const std::string& posColumn, std::string& error)
+    {
+        std::string index    = GetSpatialIndexName(table);
+        auto        triggers = GetSpatialTriggers(table, idColumn, posColumn);
+
+        // queries join on the columns passed in, an index kept in sync from other ones would return wrong rows
+        if (TableExists(db, index))
+        {
+            for (auto& [name, sql] : triggers)
+            {
+                if (!TriggerMatches(db, name, sql))
+                {
+                    error = index + " already exists and isn't kept in sync from " + idColumn + " and " + posColumn;
+                    return SQLITE_ERROR;
+                }
+            }
+            return SQLITE_OK;
+        }
+
+        std::string idx = QuoteIdentifier(index);
+        std::string tbl = QuoteIdentifier(table);
+        std::string id  = QuoteIdentifier(idColumn);
+        std::string pos = QuoteIdentifier(posColumn);
+
+        // savepoint instead of BEGIN so it also works inside a transaction of the caller
+        std::string sql = "SAVEPOINT spatial_index;"
+                          "CREATE VIRTUAL TABLE " + idx + " USING rtree(id, minX, maxX, minY, maxY, minZ, maxZ);"
+                          "INSERT INTO " + idx + " SELECT " + id + ", " + GetBounds(pos) + " FROM " + tbl + " WHERE vec3_x(" + pos + ") IS NOT NULL;";
+        for (auto& trigger : triggers)
+            sql += trigger.second + ";";
+        sql += "RELEASE spatial_index;";
+
+        int ret = sqlite3_exec(db, sql.c_str(), 0, 0, 0);
+        if (ret != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(db);
+            sqlite3_exec(db, "ROLLBACK TO spatial_index; RELEASE spatial_index;", 0, 0, 0);
+        }
+
+        return ret;
+    }
+
+    int RebuildSpatialIndex(sqlite3* db, const std::string& table, const std::string& idColumn, const std::string& posColumn, std::string& error)
+    {
+        std::string idx = QuoteIdentifier(GetSpatialIndexName(table));
+        std::string pos = QuoteIdentifier(posColumn);
+
+        std::string sql = "SAVEPOINT spatial_index;"
+                          "DELETE FROM " + idx + ";"
+                          "INSERT INTO " + idx + " SELECT " + QuoteIdentifier(idColumn) + ", " + GetBounds(pos) + " FROM " + QuoteIdentifier(table) + " WHERE vec3_x(" + pos + ") IS NOT NULL;"
+                          "RELEASE spatial_index;";
+
+        int ret = sqlite3_exec(db, sql.c_str(), 0, 0, 0);
+        if (ret != SQLITE_OK)
+        {
+            error = sqlite3_errmsg(db);
+            sqlite3_exec(db, "ROLLBACK TO spatial_index; RELEASE spatial_index;", 0, 0, 0);
+        }
+
+        return ret;
+    }
+
+    std::string GetSpatialQuery(const std::string& table, const std::string& idColumn, const std::string& posColumn, bool box)
+    {
+        std::string tbl = QuoteIdentifier(table);
+        std::string pos = "t." + QuoteIdentifier(posColumn);
+
+        // the R*Tree narrows the candidates, the exact test runs on the packed vector
+        std::string sql = "SELECT t.* FROM " + QuoteIdentifier(GetSpatialIndexName(table)) + " r JOIN " + tbl + " t ON t." + QuoteIdentifier(idColumn) + " = r.id WHERE ";
+        if (box)
+            return sql + "r.maxX >= ?1 AND r.minX <= ?4 AND r.maxY >= ?2 AND r.minY <= ?5 AND r.maxZ >= ?3 AND r.minZ <= ?6 AND aabb_contains(" + pos + ", ?1, ?2, ?3, ?4, ?5, ?6)";
+
+        return sql + "r.maxX >= ?1 - ?4 AND r.minX <= ?1 + ?4 AND r.maxY >= ?2 - ?4 AND r.minY <= ?2 + ?4 AND r.maxZ >= ?3 - ?4 AND r.minZ <= ?3 + ?4 AND vec3_within(" + pos + ", ?1, ?2, ?3, ?4) "
+               "ORDER BY vec3_dist(" + pos + ", ?1, ?2, ?3)";
+    }
+} // namespace module
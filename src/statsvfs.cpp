@@ -0,0 +1,156 @@
+#include "statsvfs.hpp"
+
+#include "vfsshim.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace module
+{
+    struct IoCounters
+    {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> totalUs;
+        std::atomic<uint64_t> maxUs;
+        std::atomic<uint64_t> histogram[IO_HISTOGRAM_BUCKETS];
+    };
+
+    struct FileCounters
+    {
+        IoCounters operations[IO_OPERATION_COUNT];
+    };
+
+    struct StatsFile
+    {
+        ShimFile      shim;
+        FileCounters* counters;
+    };
+
+    // counters are kept after a file is closed so reopened databases keep accumulating
+    static std::mutex                                           s_countersMutex;
+    static std::map<std::string, std::unique_ptr<FileCounters>> s_counters;
+
+    static sqlite3_vfs        s_statsVfs;
+    static sqlite3_io_methods s_statsIoMethods;
+
+    static void Record(sqlite3_file* file, IoOperation operation, std::chrono::steady_clock::time_point start, uint64_t bytes)
+    {
+        uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        int bucket = 0;
+        while (bucket < IO_HISTOGRAM_BUCKETS - 1 && us >= (1ull << bucket))
+            bucket++;
+
+        auto& counters = ((StatsFile*)file)->counters->operations[operation];
+        counters.count.fetch_add(1, std::memory_order_relaxed);
+        counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        counters.totalUs.fetch_add(us, std::memory_order_relaxed);
+        counters.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t max = counters.maxUs.load(std::memory_order_relaxed);
+        while (us > max && !counters.maxUs.compare_exchange_weak(max, us, std::memory_order_relaxed))
+            ;
+    }
+
+    static int StatsRead(sqlite3_file* file, void* data, int amount, sqlite3_int64 offset)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int  ret   = GetRealFile(file)->pMethods->xRead(GetRealFile(file), data, amount, offset);
+        Record(file, IO_READ, start, amount);
+        return ret;
+    }
+
+    static int StatsWrite(sqlite3_file* file, const void* data, int amount, sqlite3_int64 offset)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int  ret   = GetRealFile(file)->pMethods->xWrite(GetRealFile(file), data, amount, offset);
+        Record(file, IO_WRITE, start, amount);
+        return ret;
+    }
+
+    static int StatsSync(sqlite3_file* file, int flags)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int  ret   = GetRealFile(file)->pMethods->xSync(GetRealFile(file), flags);
+        Record(file, IO_SYNC, start, 0);
+        return ret;
+    }
+
+    static int StatsLock(sqlite3_file* file, int lock)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int  ret   = GetRealFile(file)->pMethods->xLock(GetRealFile(file), lock);
+        Record(file, IO_LOCK, start, 0);
+        return ret;
+    }
+
+    static int StatsShmMap(sqlite3_file* file, int page, int pageSize, int extend, void volatile** data)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int  ret   = GetRealFile(file)->pMethods->xShmMap(GetRealFile(file), page, pageSize, extend, data);
+        Record(file, IO_SHMMAP, start, pageSize);
+        return ret;
+    }
+
+    static int StatsOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags)
+    {
+        {
+            std::lock_guard<std::mutex> lock(s_countersMutex);
+
+            auto& counters = s_counters[name ? name : "(temp)"];
+            if (!counters)
+                counters = std::make_unique<FileCounters>();
+
+            ((StatsFile*)file)->counters = counters.get();
+        }
+
+        return OpenShimFile(vfs, name, file, flags, outFlags, &s_statsIoMethods);
+    }
+
+    void RegisterStatsVfs()
+    {
+        s_statsIoMethods         = GetShimIoMethods();
+        s_statsIoMethods.xRead   = StatsRead;
+        s_statsIoMethods.xWrite  = StatsWrite;
+        s_statsIoMethods.xSync   = StatsSync;
+        s_statsIoMethods.xLock   = StatsLock;
+        s_statsIoMethods.xShmMap = StatsShmMap;
+
+        InitShimVfs(&s_statsVfs, sqlite3_vfs_find(nullptr), "stats", sizeof(StatsFile), StatsOpen);
+        sqlite3_vfs_register(&s_statsVfs, 0);
+    }
+
+    const char* GetIoOperationName(int operation)
+    {
+        static const char* const names[IO_OPERATION_COUNT] = { "read", "write", "sync", "lock", "shmMap" };
+        return names[operation];
+    }
+
+    std::map<std::string, IoFileStats> GetIoStats(bool reset)
+    {
+        std::map<std::string, IoFileStats> result;
+
+        std::lock_guard<std::mutex> lock(s_countersMutex);
+        for (auto& [name, counters] : s_counters)
+        {
+            auto& stats = result[name];
+            for (int op = 0; op < IO_OPERATION_COUNT; op++)
+            {
+                auto& from = counters->operations[op];
+                auto& to   = stats[op];
+
+                to.count   = reset ? from.count.exchange(0) : from.count.load();
+                to.bytes   = reset ? from.bytes.exchange(0) : from.bytes.load();
+                to.totalUs = reset ? from.totalUs.exchange(0) : from.totalUs.load();
+                to.maxUs   = reset ? from.maxUs.exchange(0) : from.maxUs.load();
+                for (int i = 0; i < IO_HISTOGRAM_BUCKETS; i++)
+                    to.histogram[i] = reset ? from.histogram[i].exchange(0) : from.histogram[i].load();
+            }
+        }
+
+        return result;
+    }
+} // namespace module
@@ -0,0 +1,695 @@
+#include "uringvfs.hpp"
+
+#include "vfsshim.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #define SQLMODULE_URING 1
+#endif
+
+#ifdef SQLMODULE_URING
+    #include <algorithm>
+    #include <atomic>
+    #include <cerrno>
+    #include <chrono>
+    #include <condition_variable>
+    #include <cstring>
+    #include <fcntl.h>
+    #include <linux/io_uring.h>
+    #include <map>
+    #include <mutex>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+    #include <vector>
+#endif
+
+namespace module
+{
+    static sqlite3_vfs s_uringVfs;
+
+#ifdef SQLMODULE_URING
+    constexpr unsigned      URING_ENTRIES        = 256;
+    constexpr size_t        URING_MAX_PENDING    = 16 * 1024 * 1024;
+    constexpr sqlite3_int64 URING_PREFETCH_BYTES = 1024 * 1024;
+
+    // user_data of fadvise requests, their completions are only reaped
+    constexpr uint64_t URING_PREFETCH = ~0ull;
+
+    // attempts and pause between them while io_uring_enter reports a transient failure, a few milliseconds at most
+    // before the flush falls back to synchronous writes
+    constexpr int URING_MAX_RETRIES = 20;
+    constexpr int URING_RETRY_US    = 100;
+
+    // how long writes the kernel still has are waited for after the ring failed, before their file is given up
+    constexpr int URING_DRAIN_MS = 5000;
+
+    struct Uring
+    {
+        int fd = -1;
+
+        unsigned* sqHead;
+        unsigned* sqTail;
+        unsigned* sqMask;
+        unsigned* sqArray;
+        unsigned  sqEntries;
+
+        unsigned* cqHead;
+        unsigned* cqTail;
+        unsigned* cqMask;
+
+        io_uring_sqe* sqes;
+        io_uring_cqe* cqes;
+
+        unsigned queued;
+        unsigned inflight;
+    };
+
+    // descriptor batched writes go through, one per file shared by every connection on it: closing a descriptor drops
+    // the POSIX locks the process holds on the file, so it's only closed once no io_uring connection has it open
+    struct WriteFd
+    {
+        int fd;
+        int users;
+    };
+
+    struct UringFile
+    {
+        ShimFile shim;
+
+        // write-only descriptor of our own, -1 when the file isn't batched
+        int fd;
+
+        // queued writes by offset, only touched with s_uringMutex held
+        std::map<sqlite3_int64, std::vector<uint8_t>>* pending;
+        size_t                                         pendingBytes;
+        int                                            error;
+
+        // writes of the file may still be done by the kernel at any time, nothing may be written anymore
+        bool failed;
+
+        sqlite3_int64 lastReadEnd;
+        sqlite3_int64 prefetchedUntil;
+    };
+
+    static Uring                   s_uring;
+    static std::mutex              s_uringMutex;
+    static std::vector<UringFile*> s_pendingFiles;
+    static std::atomic<int>        s_pendingCount;
+    static bool                    s_uringBroken = false;
+    static sqlite3_io_methods      s_uringIoMethods;
+
+    // set while a flush owns the ring, it releases s_uringMutex while waiting on the kernel or backing off
+    static bool                    s_ringBusy = false;
+    static std::condition_variable s_ringIdle;
+
+    // buffers of writes the kernel never reported back, they have to stay valid as long as the process runs
+    static std::vector<std::map<sqlite3_int64, std::vector<uint8_t>>> s_abandonedWrites;
+    static std::vector<std::vector<iovec>>                            s_abandonedIovecs;
+
+    // by device and inode, only touched with s_uringMutex held
+    static std::map<std::pair<dev_t, ino_t>, WriteFd> s_writeFds;
+
+    static bool SetupUring(Uring& ring)
+    {
+        io_uring_params params {};
+
+        int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+        if (fd < 0)
+            return false;
+
+        size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sqSize = cqSize = std::max(sqSize, cqSize);
+
+        void* sq = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        void* cq = params.features & IORING_FEAT_SINGLE_MMAP ? sq : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        void* sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+
+        ring.fd        = fd;
+        ring.sqHead    = (unsigned*)((char*)sq + params.sq_off.head);
+        ring.sqTail    = (unsigned*)((char*)sq + params.sq_off.tail);
+        ring.sqMask    = (unsigned*)((char*)sq + params.sq_off.ring_mask);
+        ring.sqArray   = (unsigned*)((char*)sq + params.sq_off.array);
+        ring.sqEntries = params.sq_entries;
+        ring.cqHead    = (unsigned*)((char*)cq + params.cq_off.head);
+        ring.cqTail    = (unsigned*)((char*)cq + params.cq_off.tail);
+        ring.cqMask    = (unsigned*)((char*)cq + params.cq_off.ring_mask);
+        ring.sqes      = (io_uring_sqe*)sqes;
+        ring.cqes      = (io_uring_cqe*)((char*)cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // returns -1 if the file can't be opened for writing, batching is skipped then
+    static int OpenWriteFd(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(s_uringMutex);
+
+        // look the file up by path first, opening and closing another descriptor would drop the locks of others
+        struct stat st;
+        if (stat(name, &st) != 0)
+            return -1;
+
+        auto it = s_writeFds.find({ st.st_dev, st.st_ino });
+        if (it != s_writeFds.end())
+        {
+            it->second.users++;
+            return it->second.fd;
+        }
+
+        int fd = open(name, O_WRONLY | O_CLOEXEC);
+        if (fd < 0)
+            return -1;
+
+        // keyed by what was actually opened in case the file was replaced since the lookup
+        struct stat opened;
+        if (fstat(fd, &opened) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+
+        s_writeFds[{ opened.st_dev, opened.st_ino }] = WriteFd { fd, 1 };
+        return fd;
+    }
+
+    static void CloseWriteFd(int fd)
+    {
+        std::lock_guard<std::mutex> lock(s_uringMutex);
+        for (auto it = s_writeFds.begin(); it != s_writeFds.end(); ++it)
+        {
+            if (it->second.fd == fd && --it->second.users <= 0)
+            {
+                close(fd);
+                s_writeFds.erase(it);
+                return;
+            }
+        }
+    }
+
+    static io_uring_sqe* GetSqe(Uring& ring)
+    {
+        // completions are reaped before more is queued, so the completion queue (twice the size) can't overflow
+        if (ring.inflight + ring.queued >= ring.sqEntries)
+            return nullptr;
+
+        unsigned tail = *ring.sqTail;
+        unsigned idx  = tail & *ring.sqMask;
+
+        io_uring_sqe* sqe = &ring.sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+
+        ring.sqArray[idx] = idx;
+        __atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+        ring.queued++;
+        return sqe;
+    }
+
+    static int Enter(Uring& ring, unsigned minComplete)
+    {
+        int ret;
+        do
+            ret = (int)syscall(__NR_io_uring_enter, ring.fd, ring.queued, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        while (ret < 0 && errno == EINTR);
+
+        // errno is taken right away, completions may call pwrite before the caller looks at it
+        if (ret < 0)
+            return -errno;
+
+        ring.inflight += ret;
+        ring.queued -= ret;
+        return ret;
+    }
+
+    // calls complete(user_data, res) for every finished write, prefetch completions are dropped
+    template <typename Callback>
+    static void Reap(Uring& ring, Callback complete)
+    {
+        unsigned head = *ring.cqHead;
+        unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++)
+        {
+            io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+            if (cqe->user_data != URING_PREFETCH)
+                complete(cqe->user_data, cqe->res);
+            ring.inflight--;
+        }
+
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    static bool WriteFully(int fd, const uint8_t* data, size_t size, sqlite3_int64 offset)
+    {
+        while (size > 0)
+        {
+            ssize_t written = pwrite(fd, data, size, offset);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+
+            data += written;
+            size -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    // the ring is only touched by the flush that set s_ringBusy, so the kernel is waited on without s_uringMutex
+    static int EnterUnlocked(Uring& ring, unsigned minComplete, std::unique_lock<std::mutex>& lock)
+    {
+        lock.unlock();
+        int ret = Enter(ring, minComplete);
+        lock.lock();
+        return ret;
+    }
+
+    // submits the queued entries and waits until minComplete finished, retrying for a few milliseconds while the
+    // kernel is short on resources (EAGAIN) or its completion queue is full (EBUSY); returns 0 or the errno it gave up on
+    template <typename Callback>
+    static int Submit(Uring& ring, unsigned minComplete, Callback complete, std::unique_lock<std::mutex>& lock)
+    {
+        int ret = 0;
+        for (int attempt = 0; attempt < URING_MAX_RETRIES; attempt++)
+        {
+            ret = EnterUnlocked(ring, minComplete, lock);
+            Reap(ring, complete);
+            if (ret >= 0)
+                return 0;
+            if (ret != -EAGAIN && ret != -EBUSY)
+                return -ret;
+
+            lock.unlock();
+            usleep(URING_RETRY_US);
+            lock.lock();
+        }
+        return -ret;
+    }
+
+    // reaps until nothing is in flight anymore, false if the kernel still has requests after URING_DRAIN_MS
+    template <typename Callback>
+    static bool Drain(Uring& ring, Callback complete, std::unique_lock<std::mutex>& lock)
+    {
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(URING_DRAIN_MS);
+        while (true)
+        {
+            Reap(ring, complete);
+            if (!ring.inflight)
+                return true;
+            if (std::chrono::steady_clock::now() >= end)
+                return false;
+
+            // the ring may refuse to wait as well, completions still show up in the queue then
+            if (EnterUnlocked(ring, 1, lock) < 0)
+            {
+                lock.unlock();
+                usleep(URING_RETRY_US);
+                lock.lock();
+            }
+        }
+    }
+
+    // submits all queued writes of a file and waits for them, s_uringMutex has to be held; it's released while the
+    // kernel is waited on, the file can queue new writes meanwhile
+    static void FlushFile(UringFile* file, std::unique_lock<std::mutex>& lock)
+    {
+        s_ringIdle.wait(lock, [] { return !s_ringBusy; });
+        if (file->pending->empty())
+            return;
+
+        // still counted in s_pendingCount until the writes are done, so FlushAll waits for them
+        std::map<sqlite3_int64, std::vector<uint8_t>> pending = std::move(*file->pending);
+        file->pending->clear();
+        file->pendingBytes = 0;
+        s_pendingFiles.erase(std::find(s_pendingFiles.begin(), s_pendingFiles.end(), file));
+        s_ringBusy = true;
+
+        std::vector<iovec>                                                    iovecs;
+        std::vector<std::map<sqlite3_int64, std::vector<uint8_t>>::iterator> writes;
+        std::vector<bool>                                                     completed;
+        iovecs.reserve(pending.size());
+        writes.reserve(pending.size());
+        completed.resize(pending.size());
+
+        auto complete = [&](uint64_t index, int res) {
+            auto& write      = *writes[index];
+            completed[index] = true;
+            if (res == (int)write.second.size())
+                return;
+
+            // short write or the kernel refused the request, finish it synchronously
+            size_t done = res > 0 ? res : 0;
+            if (!WriteFully(file->fd, write.second.data() + done, write.second.size() - done, write.first + done))
+                file->error = SQLITE_IOERR_WRITE;
+        };
+
+        bool usable  = !s_uringBroken;
+        int  failure = 0;
+        for (auto it = pending.begin(); usable && !failure && it != pending.end(); it++)
+        {
+            io_uring_sqe* sqe = GetSqe(s_uring);
+            while (!failure && !sqe)
+            {
+                failure = Submit(s_uring, s_uring.inflight + s_uring.queued, complete, lock);
+                sqe     = failure ? nullptr : GetSqe(s_uring);
+            }
+            if (!sqe)
+                break;
+
+            iovecs.push_back({ it->second.data(), it->second.size() });
+            writes.push_back(it);
+
+            sqe->opcode    = IORING_OP_WRITEV;
+            sqe->fd        = file->fd;
+            sqe->off       = it->first;
+            sqe->addr      = (uint64_t)&iovecs.back();
+            sqe->len       = 1;
+            sqe->user_data = writes.size() - 1;
+        }
+
+        // wait for everything in flight, including prefetches, so no write outlives its buffer
+        while (usable && !failure && (s_uring.queued || s_uring.inflight))
+            failure = Submit(s_uring, s_uring.inflight + s_uring.queued, complete, lock);
+
+        if (failure)
+        {
+            // take back what the kernel never saw, those entries point at the buffers released below
+            __atomic_store_n(s_uring.sqTail, *s_uring.sqTail - s_uring.queued, __ATOMIC_RELEASE);
+            s_uring.queued = 0;
+
+            // the ring is still fine after giving up on a transient failure
+            if (failure != EAGAIN && failure != EBUSY)
+                s_uringBroken = true;
+
+            // a write the kernel still has could land after a synchronous one to the same offset and put stale
+            // data back, so nothing is written before all of them are done
+            if (!Drain(s_uring, complete, lock))
+            {
+                s_uringBroken = true;
+                file->failed  = true;
+                file->error   = SQLITE_IOERR_WRITE;
+                s_abandonedIovecs.push_back(std::move(iovecs));
+                s_abandonedWrites.push_back(std::move(pending));
+                pending.clear();
+            }
+        }
+
+        // whatever didn't complete through the ring is written synchronously, in the order of the map like the
+        // submitted writes
+        size_t index = 0;
+        for (auto& [offset, buffer] : pending)
+        {
+            if (!completed[index++] && !WriteFully(file->fd, buffer.data(), buffer.size(), offset))
+                file->error = SQLITE_IOERR_WRITE;
+        }
+
+        s_ringBusy = false;
+        s_pendingCount--;
+        s_ringIdle.notify_all();
+    }
+
+    static void FlushAll()
+    {
+        if (s_pendingCount.load(std::memory_order_acquire) == 0)
+            return;
+
+        // a file is only picked once the ring is idle, a flush running meanwhile may be the one of a file being closed
+        std::unique_lock<std::mutex> lock(s_uringMutex);
+        while (true)
+        {
+            s_ringIdle.wait(lock, [] { return !s_ringBusy; });
+            if (s_pendingFiles.empty())
+                break;
+            FlushFile(s_pendingFiles.back(), lock);
+        }
+    }
+
+    // reports a failed batched write on the next call that can return an error
+    static int TakeError(sqlite3_file* file)
+    {
+        auto* uring = (UringFile*)file;
+        if (!uring->error)
+            return SQLITE_OK;
+
+        std::lock_guard<std::mutex> lock(s_uringMutex);
+        int                         error = uring->error;
+
+        // a failed file keeps failing
+        if (!uring->failed)
+            uring->error = SQLITE_OK;
+        return error;
+    }
+
+    static int UringWrite(sqlite3_file* file, const void* data, int amount, sqlite3_int64 offset)
+    {
+        auto* uring = (UringFile*)file;
+        if (uring->fd < 0)
+            return GetRealFile(file)->pMethods->xWrite(GetRealFile(file), data, amount, offset);
+
+        std::unique_lock<std::mutex> lock(s_uringMutex);
+        if (uring->failed)
+            return SQLITE_IOERR_WRITE;
+
+        // io_uring doesn't order requests, anything overlapping a queued write (except a rewrite of the same page)
+        // goes out first
+        auto& pending = *uring->pending;
+        auto  next    = pending.lower_bound(offset);
+        bool  same    = next != pending.end() && next->first == offset && next->second.size() == (size_t)amount;
+        bool  overlap = (next != pending.end() && next->first < offset + amount) || (next != pending.begin() && std::prev(next)->first + (sqlite3_int64)std::prev(next)->second.size() > offset);
+        if (overlap && !same)
+        {
+            FlushFile(uring, lock);
+            if (uring->failed)
+                return SQLITE_IOERR_WRITE;
+        }
+
+        if (pending.empty())
+        {
+            s_pendingFiles.push_back(uring);
+            s_pendingCount++;
+        }
+
+        auto& buffer = pending[offset];
+        uring->pendingBytes += amount - buffer.size();
+        buffer.assign((const uint8_t*)data, (const uint8_t*)data + amount);
+
+        if (uring->pendingBytes >= URING_MAX_PENDING)
+            FlushFile(uring, lock);
+
+        return uring->error ? SQLITE_IOERR_WRITE : SQLITE_OK;
+    }
+
+    static void Prefetch(UringFile* file, sqlite3_int64 offset, int amount)
+    {
+        bool sequential   = offset == file->lastReadEnd;
+        file->lastReadEnd = offset + amount;
+        if (!sequential)
+            file->prefetchedUntil = 0;
+
+        if (!sequential || file->lastReadEnd + URING_PREFETCH_BYTES / 2 < file->prefetchedUntil)
+            return;
+
+        std::unique_lock<std::mutex> lock(s_uringMutex, std::try_to_lock);
+        if (!lock.owns_lock() || s_uringBroken || s_ringBusy)
+            return;
+
+        // drop finished prefetches so they don't take up queue space
+        Reap(s_uring, [](uint64_t, int) {});
+
+        io_uring_sqe* sqe = GetSqe(s_uring);
+        if (!sqe)
+            return;
+
+        sqlite3_int64 start = std::max(file->lastReadEnd, file->prefetchedUntil);
+
+        sqe->opcode         = IORING_OP_FADVISE;
+        sqe->fd             = file->fd;
+        sqe->off            = start;
+        sqe->len            = (uint32_t)(file->lastReadEnd + URING_PREFETCH_BYTES - start);
+        sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+        sqe->user_data      = URING_PREFETCH;
+
+        Enter(s_uring, 0);
+        file->prefetchedUntil = file->lastReadEnd + URING_PREFETCH_BYTES;
+    }
+
+    static int UringRead(sqlite3_file* file, void* data, int amount, sqlite3_int64 offset)
+    {
+        FlushAll();
+
+        auto* uring = (UringFile*)file;
+        if (uring->fd >= 0)
+            Prefetch(uring, offset, amount);
+
+        int ret = TakeError(file);
+        if (ret != SQLITE_OK)
+            return ret;
+
+        return GetRealFile(file)->pMethods->xRead(GetRealFile(file), data, amount, offset);
+    }
+
+    static int UringSync(sqlite3_file* file, int flags)
+    {
+        FlushAll();
+
+        int ret = TakeError(file);
+        if (ret != SQLITE_OK)
+            return ret;
+
+        return GetRealFile(file)->pMethods->xSync(GetRealFile(file), flags);
+    }
+
+    static int UringClose(sqlite3_file* file)
+    {
+        FlushAll();
+
+        auto* uring = (UringFile*)file;
+        delete uring->pending;
+
+        int ret = GetRealFile(file)->pMethods->xClose(GetRealFile(file));
+        if (uring->fd >= 0)
+            CloseWriteFd(uring->fd);
+        return ret;
+    }
+
+    // everything else only has to see the queued writes first: another connection may be about to read them
+    // (shm barriers publish wal frames, unlocks release database pages)
+    static int UringTruncate(sqlite3_file* file, sqlite3_int64 size)
+    {
+        FlushAll();
+        if (((UringFile*)file)->failed)
+            return SQLITE_IOERR_TRUNCATE;
+        return GetRealFile(file)->pMethods->xTruncate(GetRealFile(file), size);
+    }
+
+    static int UringFileSize(sqlite3_file* file, sqlite3_int64* size)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xFileSize(GetRealFile(file), size);
+    }
+
+    static int UringLock(sqlite3_file* file, int lock)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xLock(GetRealFile(file), lock);
+    }
+
+    static int UringUnlock(sqlite3_file* file, int lock)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xUnlock(GetRealFile(file), lock);
+    }
+
+    static int UringCheckReservedLock(sqlite3_file* file, int* result)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xCheckReservedLock(GetRealFile(file), result);
+    }
+
+    static int UringFileControl(sqlite3_file* file, int op, void* arg)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xFileControl(GetRealFile(file), op, arg);
+    }
+
+    static int UringShmMap(sqlite3_file* file, int page, int pageSize, int extend, void volatile** data)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xShmMap(GetRealFile(file), page, pageSize, extend, data);
+    }
+
+    static int UringShmLock(sqlite3_file* file, int offset, int n, int flags)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xShmLock(GetRealFile(file), offset, n, flags);
+    }
+
+    static void UringShmBarrier(sqlite3_file* file)
+    {
+        FlushAll();
+        GetRealFile(file)->pMethods->xShmBarrier(GetRealFile(file));
+    }
+
+    static int UringFetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** data)
+    {
+        FlushAll();
+        return GetRealFile(file)->pMethods->xFetch(GetRealFile(file), offset, amount, data);
+    }
+
+    static int UringOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags)
+    {
+        auto* uring            = (UringFile*)file;
+        uring->fd              = -1;
+        uring->pending         = nullptr;
+        uring->pendingBytes    = 0;
+        uring->error           = SQLITE_OK;
+        uring->failed          = false;
+        uring->lastReadEnd     = -1;
+        uring->prefetchedUntil = 0;
+
+        int ret = OpenShimFile(vfs, name, file, flags, outFlags, &s_uringIoMethods);
+        if (ret != SQLITE_OK || !file->pMethods)
+            return ret;
+
+        uring->pending = new std::map<sqlite3_int64, std::vector<uint8_t>>;
+
+        // temp files and the like don't need durability, only the files written during commit and checkpoint are batched
+        if (s_uring.fd >= 0 && name && !(flags & SQLITE_OPEN_READONLY) && (flags & (SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_WAL)))
+            uring->fd = OpenWriteFd(name);
+
+        return ret;
+    }
+
+    void RegisterUringVfs()
+    {
+        sqlite3_vfs* real = sqlite3_vfs_find(nullptr);
+
+        // batched writes open the file by name, which needs the unix VFS (or a variant like unix-excl) being wrapped
+        if (strncmp(real->zName, "unix", 4) == 0)
+            SetupUring(s_uring);
+
+        s_uringIoMethods                    = GetShimIoMethods();
+        s_uringIoMethods.xClose             = UringClose;
+        s_uringIoMethods.xRead              = UringRead;
+        s_uringIoMethods.xWrite             = UringWrite;
+        s_uringIoMethods.xTruncate          = UringTruncate;
+        s_uringIoMethods.xSync              = UringSync;
+        s_uringIoMethods.xFileSize          = UringFileSize;
+        s_uringIoMethods.xLock              = UringLock;
+        s_uringIoMethods.xUnlock            = UringUnlock;
+        s_uringIoMethods.xCheckReservedLock = UringCheckReservedLock;
+        s_uringIoMethods.xFileControl       = UringFileControl;
+        s_uringIoMethods.xShmMap            = UringShmMap;
+        s_uringIoMethods.xShmLock           = UringShmLock;
+        s_uringIoMethods.xShmBarrier        = UringShmBarrier;
+        s_uringIoMethods.xFetch             = UringFetch;
+
+        InitShimVfs(&s_uringVfs, real, "io_uring", sizeof(UringFile), UringOpen);
+        sqlite3_vfs_register(&s_uringVfs, 0);
+    }
+#else
+    static sqlite3_io_methods s_uringIoMethods;
+
+    static int UringOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags)
+    {
+        return OpenShimFile(vfs, name, file, flags, outFlags, &s_uringIoMethods);
+    }
+
+    void RegisterUringVfs()
+    {
+        // no io_uring on this platform, register a plain pass-through so scripts can select it anywhere
+        s_uringIoMethods = GetShimIoMethods();
+
+        InitShimVfs(&s_uringVfs, sqlite3_vfs_find(nullptr), "io_uring", sizeof(ShimFile), UringOpen);
+        sqlite3_vfs_register(&s_uringVfs, 0);
+    }
+#endif
+} // namespace module
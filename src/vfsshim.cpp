@@ -0,0 +1,260 @@
+#include "vfsshim.hpp"
+
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace module
+{
+    static int ShimFileOffset(sqlite3_vfs* vfs)
+    {
+        return vfs->szOsFile - GetRealVfs(vfs)->szOsFile;
+    }
+
+    static int ShimClose(sqlite3_file* file)
+    {
+        return GetRealFile(file)->pMethods->xClose(GetRealFile(file));
+    }
+
+    static int ShimRead(sqlite3_file* file, void* data, int amount, sqlite3_int64 offset)
+    {
+        return GetRealFile(file)->pMethods->xRead(GetRealFile(file), data, amount, offset);
+    }
+
+    static int ShimWrite(sqlite3_file* file, const void* data, int amount, sqlite3_int64 offset)
+    {
+        return GetRealFile(file)->pMethods->xWrite(GetRealFile(file), data, amount, offset);
+    }
+
+    static int ShimTruncate(sqlite3_file* file, sqlite3_int64 size)
+    {
+        return GetRealFile(file)->pMethods->xTruncate(GetRealFile(file), size);
+    }
+
+    static int ShimSync(sqlite3_file* file, int flags)
+    {
+        return GetRealFile(file)->pMethods->xSync(GetRealFile(file), flags);
+    }
+
+    static int ShimFileSize(sqlite3_file* file, sqlite3_int64* size)
+    {
+        return GetRealFile(file)->pMethods->xFileSize(GetRealFile(file), size);
+    }
+
+    static int ShimLock(sqlite3_file* file, int lock)
+    {
+        return GetRealFile(file)->pMethods->xLock(GetRealFile(file), lock);
+    }
+
+    static int ShimUnlock(sqlite3_file* file, int lock)
+    {
+        return GetRealFile(file)->pMethods->xUnlock(GetRealFile(file), lock);
+    }
+
+    static int ShimCheckReservedLock(sqlite3_file* file, int* result)
+    {
+        return GetRealFile(file)->pMethods->xCheckReservedLock(GetRealFile(file), result);
+    }
+
+    static int ShimFileControl(sqlite3_file* file, int op, void* arg)
+    {
+        return GetRealFile(file)->pMethods->xFileControl(GetRealFile(file), op, arg);
+    }
+
+    static int ShimSectorSize(sqlite3_file* file)
+    {
+        return GetRealFile(file)->pMethods->xSectorSize(GetRealFile(file));
+    }
+
+    static int ShimDeviceCharacteristics(sqlite3_file* file)
+    {
+        return GetRealFile(file)->pMethods->xDeviceCharacteristics(GetRealFile(file));
+    }
+
+    static int ShimShmMap(sqlite3_file* file, int page, int pageSize, int extend, void volatile** data)
+    {
+        return GetRealFile(file)->pMethods->xShmMap(GetRealFile(file), page, pageSize, extend, data);
+    }
+
+    static int ShimShmLock(sqlite3_file* file, int offset, int n, int flags)
+    {
+        return GetRealFile(file)->pMethods->xShmLock(GetRealFile(file), offset, n, flags);
+    }
+
+    static void ShimShmBarrier(sqlite3_file* file)
+    {
+        GetRealFile(file)->pMethods->xShmBarrier(GetRealFile(file));
+    }
+
+    static int ShimShmUnmap(sqlite3_file* file, int deleteFlag)
+    {
+        return GetRealFile(file)->pMethods->xShmUnmap(GetRealFile(file), deleteFlag);
+    }
+
+    static int ShimFetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** data)
+    {
+        return GetRealFile(file)->pMethods->xFetch(GetRealFile(file), offset, amount, data);
+    }
+
+    static int ShimUnfetch(sqlite3_file* file, sqlite3_int64 offset, void* data)
+    {
+        return GetRealFile(file)->pMethods->xUnfetch(GetRealFile(file), offset, data);
+    }
+
+    sqlite3_io_methods GetShimIoMethods()
+    {
+        return {
+            3,
+            ShimClose,
+            ShimRead,
+            ShimWrite,
+            ShimTruncate,
+            ShimSync,
+            ShimFileSize,
+            ShimLock,
+            ShimUnlock,
+            ShimCheckReservedLock,
+            ShimFileControl,
+            ShimSectorSize,
+            ShimDeviceCharacteristics,
+            ShimShmMap,
+            ShimShmLock,
+            ShimShmBarrier,
+            ShimShmUnmap,
+            ShimFetch,
+            ShimUnfetch,
+        };
+    }
+
+    // copies of a shim's methods cut down to an older version, made the first time a real file of that version shows up
+    static std::mutex                                                               s_versionedMethodsMutex;
+    static std::map<std::pair<const sqlite3_io_methods*, int>, sqlite3_io_methods*> s_versionedMethods;
+
+    // SQLite checks iVersion before using the shm (2) and mmap (3) methods, a shim has to report the version of the
+    // file it forwards to, e.g. the unix-dotfile and unix-flock files are version 1 and have none of them
+    static const sqlite3_io_methods* GetVersionedMethods(const sqlite3_io_methods* methods, int version)
+    {
+        if (version >= methods->iVersion)
+            return methods;
+
+        std::lock_guard<std::mutex> lock(s_versionedMethodsMutex);
+
+        auto*& versioned = s_versionedMethods[{ methods, version }];
+        if (!versioned)
+        {
+            versioned           = new sqlite3_io_methods(*methods);
+            versioned->iVersion = version;
+            if (version < 2)
+            {
+                versioned->xShmMap     = nullptr;
+                versioned->xShmLock    = nullptr;
+                versioned->xShmBarrier = nullptr;
+                versioned->xShmUnmap   = nullptr;
+            }
+            if (version < 3)
+            {
+                versioned->xFetch   = nullptr;
+                versioned->xUnfetch = nullptr;
+            }
+        }
+        return versioned;
+    }
+
+    int OpenShimFile(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* outFlags, const sqlite3_io_methods* methods)
+    {
+        auto* shim = (ShimFile*)file;
+        shim->real = (sqlite3_file*)((char*)file + ShimFileOffset(vfs));
+
+        int ret = GetRealVfs(vfs)->xOpen(GetRealVfs(vfs), name, shim->real, flags, outFlags);
+
+        // sqlite only calls xClose when pMethods is set
+        shim->base.pMethods = shim->real->pMethods ? GetVersionedMethods(methods, shim->real->pMethods->iVersion) : nullptr;
+        return ret;
+    }
+
+    static int ShimDelete(sqlite3_vfs* vfs, const char* name, int syncDir)
+    {
+        return GetRealVfs(vfs)->xDelete(GetRealVfs(vfs), name, syncDir);
+    }
+
+    static int ShimAccess(sqlite3_vfs* vfs, const char* name, int flags, int* result)
+    {
+        return GetRealVfs(vfs)->xAccess(GetRealVfs(vfs), name, flags, result);
+    }
+
+    static int ShimFullPathname(sqlite3_vfs* vfs, const char* name, int size, char* out)
+    {
+        return GetRealVfs(vfs)->xFullPathname(GetRealVfs(vfs), name, size, out);
+    }
+
+    static void* ShimDlOpen(sqlite3_vfs* vfs, const char* filename)
+    {
+        return GetRealVfs(vfs)->xDlOpen(GetRealVfs(vfs), filename);
+    }
+
+    static void ShimDlError(sqlite3_vfs* vfs, int size, char* error)
+    {
+        GetRealVfs(vfs)->xDlError(GetRealVfs(vfs), size, error);
+    }
+
+    static void (*ShimDlSym(sqlite3_vfs* vfs, void* handle, const char* symbol))(void)
+    {
+        return GetRealVfs(vfs)->xDlSym(GetRealVfs(vfs), handle, symbol);
+    }
+
+    static void ShimDlClose(sqlite3_vfs* vfs, void* handle)
+    {
+        GetRealVfs(vfs)->xDlClose(GetRealVfs(vfs), handle);
+    }
+
+    static int ShimRandomness(sqlite3_vfs* vfs, int size, char* out)
+    {
+        return GetRealVfs(vfs)->xRandomness(GetRealVfs(vfs), size, out);
+    }
+
+    static int ShimSleep(sqlite3_vfs* vfs, int microseconds)
+    {
+        return GetRealVfs(vfs)->xSleep(GetRealVfs(vfs), microseconds);
+    }
+
+    static int ShimCurrentTime(sqlite3_vfs* vfs, double* time)
+    {
+        return GetRealVfs(vfs)->xCurrentTime(GetRealVfs(vfs), time);
+    }
+
+    static int ShimGetLastError(sqlite3_vfs* vfs, int size, char* error)
+    {
+        return GetRealVfs(vfs)->xGetLastError(GetRealVfs(vfs), size, error);
+    }
+
+    static int ShimCurrentTimeInt64(sqlite3_vfs* vfs, sqlite3_int64* time)
+    {
+        return GetRealVfs(vfs)->xCurrentTimeInt64(GetRealVfs(vfs), time);
+    }
+
+    void InitShimVfs(sqlite3_vfs* vfs, sqlite3_vfs* real, const char* name, int fileSize, ShimOpen open)
+    {
+        // keep the real file 8 byte aligned
+        fileSize = (fileSize + 7) & ~7;
+
+        *vfs                   = {};
+        vfs->iVersion          = 2;
+        vfs->szOsFile          = fileSize + real->szOsFile;
+        vfs->mxPathname        = real->mxPathname;
+        vfs->zName             = name;
+        vfs->pAppData          = real;
+        vfs->xOpen             = open;
+        vfs->xDelete           = ShimDelete;
+        vfs->xAccess           = ShimAccess;
+        vfs->xFullPathname     = ShimFullPathname;
+        vfs->xDlOpen           = ShimDlOpen;
+        vfs->xDlError          = ShimDlError;
+        vfs->xDlSym            = ShimDlSym;
+        vfs->xDlClose          = ShimDlClose;
+        vfs->xRandomness       = ShimRandomness;
+        vfs->xSleep            = ShimSleep;
+        vfs->xCurrentTime      = ShimCurrentTime;
+        vfs->xGetLastError     = ShimGetLastError;
+        vfs->xCurrentTimeInt64 = real->iVersion >= 2 ? ShimCurrentTimeInt64 : nullptr;
+    }
+} // namespace module
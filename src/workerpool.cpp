@@ -0,0 +1,266 @@
+#include "workerpool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace module
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Job
+    {
+        JobId                 id;
+        Clock::time_point     queuedAt;
+        std::function<void()> run;
+    };
+
+    struct Resource
+    {
+        std::deque<Job> queues[PRIORITY_COUNT];
+        ResourceStats   stats;
+    };
+
+    static const char* const PRIORITY_NAMES[PRIORITY_COUNT] = { "interactive", "normal", "background" };
+
+    static int s_workerCount = 2;
+    static int s_agingMs     = 500;
+
+    static uint64_t s_maxRunning = 0;
+    static uint64_t s_maxQueued  = 0;
+
+    struct WorkerPool
+    {
+        std::mutex              mutex;
+        std::condition_variable jobQueued;
+
+        std::map<ResourceId, Resource> resources;
+        QueueStats                     queueStats[PRIORITY_COUNT] = {};
+        JobId                          nextJobId = 1;
+        bool                           started   = false;
+
+        // resource each class took its last job from, the next one comes from the resource after it
+        ResourceId lastServed[PRIORITY_COUNT] = {};
+    };
+
+    // never destroyed, detached workers may still wait on it while the process exits
+    static WorkerPool& s_pool = *new WorkerPool;
+
+    // next resource in turn with a job of the class that isn't at its concurrency limit, the pool mutex has to be held
+    static std::map<ResourceId, Resource>::iterator NextResource(int priority)
+    {
+        auto& resources = s_pool.resources;
+
+        auto it = resources.upper_bound(s_pool.lastServed[priority]);
+        for (size_t i = 0; i < resources.size(); i++, ++it)
+        {
+            if (it == resources.end())
+                it = resources.begin();
+
+            auto& resource = it->second;
+            if (!resource.queues[priority].empty() && (!s_maxRunning || resource.stats.running < s_maxRunning))
+                return it;
+        }
+        return resources.end();
+    }
+
+    // picks the class and resource the next job comes from, false if nothing can run, the pool mutex has to be held
+    static bool SelectJob(bool interactiveOnly, int& queue, std::map<ResourceId, Resource>::iterator& resource)
+    {
+        // a job moves up one class for every agingMs it waited, past the interactive class as well, so a steady
+        // stream of higher priority jobs can't starve the others forever; on a tie the higher class wins
+        auto now   = Clock::now();
+        int  rank  = 0;
+        bool found = false;
+        for (int i = 0; i < (interactiveOnly ? 1 : PRIORITY_COUNT); i++)
+        {
+            auto it = NextResource(i);
+            if (it == s_pool.resources.end())
+                continue;
+
+            int aged = s_agingMs > 0 ? (int)(std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second.queues[i].front().queuedAt).count() / s_agingMs) : 0;
+            if (!found || i - aged < rank)
+            {
+                queue    = i;
+                resource = it;
+                rank     = i - aged;
+                found    = true;
+            }
+        }
+        return found;
+    }
+
+    static void RunWorker(bool interactiveOnly)
+    {
+        std::unique_lock<std::mutex> lock(s_pool.mutex);
+        while (true)
+        {
+            int  queue = 0;
+            auto it    = s_pool.resources.end();
+            s_pool.jobQueued.wait(lock, [&] { return SelectJob(interactiveOnly, queue, it); });
+
+            ResourceId id       = it->first;
+            Resource&  resource = it->second;
+
+            Job job = std::move(resource.queues[queue].front());
+            resource.queues[queue].pop_front();
+            resource.stats.queued--;
+            resource.stats.running++;
+            s_pool.lastServed[queue] = id;
+
+            auto& stats  = s_pool.queueStats[queue];
+            auto  waitUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - job.queuedAt).count();
+            stats.depth--;
+            stats.started++;
+            stats.totalWaitUs += waitUs;
+            if (waitUs > stats.maxWaitUs)
+                stats.maxWaitUs = waitUs;
+
+            lock.unlock();
+
+            // includes opening a pool connection and waiting for locks, both are load the resource causes
+            auto start = Clock::now();
+            job.run();
+            auto runUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+            lock.lock();
+
+            // std::map references stay valid, resources are never removed
+            resource.stats.running--;
+            resource.stats.completed++;
+            resource.stats.dbTimeUs += runUs;
+
+            // the resource may have been at its concurrency limit
+            if (s_maxRunning)
+                s_pool.jobQueued.notify_all();
+        }
+    }
+
+    // workers live as long as the process
+    static void StartWorkers()
+    {
+        for (int i = 0; i < s_workerCount; i++)
+            std::thread(RunWorker, i == 0 && s_workerCount > 1).detach();
+        s_pool.started = true;
+    }
+
+    const char* GetPriorityName(Priority priority)
+    {
+        return PRIORITY_NAMES[(int)priority];
+    }
+
+    bool ParsePriority(const char* name, Priority& priority)
+    {
+        for (int i = 0; i < PRIORITY_COUNT; i++)
+        {
+            if (strcmp(name, PRIORITY_NAMES[i]) == 0)
+            {
+                priority = (Priority)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ConfigureWorkers(int workerCount, int agingMs)
+    {
+        std::lock_guard<std::mutex> lock(s_pool.mutex);
+        if (s_pool.started)
+            return;
+
+        s_workerCount = std::max(workerCount, 1);
+        s_agingMs     = agingMs;
+    }
+
+    void SetResourceLimits(int maxRunning, int maxQueued)
+    {
+        std::lock_guard<std::mutex> lock(s_pool.mutex);
+        s_maxRunning = std::max(maxRunning, 0);
+        s_maxQueued  = std::max(maxQueued, 0);
+    }
+
+    JobId SubmitJob(ResourceId resourceId, Priority priority, std::function<void()> run)
+    {
+        std::lock_guard<std::mutex> lock(s_pool.mutex);
+
+        auto& resource = s_pool.resources[resourceId];
+        if (s_maxQueued && resource.stats.queued >= s_maxQueued)
+        {
+            resource.stats.rejected++;
+            return 0;
+        }
+
+        if (!s_pool.started)
+            StartWorkers();
+
+        JobId id = s_pool.nextJobId++;
+        resource.queues[(int)priority].push_back(Job { id, Clock::now(), std::move(run) });
+        resource.stats.queued++;
+        s_pool.queueStats[(int)priority].depth++;
+
+        // the interactive-only worker may be the one woken, so wake all of them
+        s_pool.jobQueued.notify_all();
+        return id;
+    }
+
+    bool CancelJob(JobId id)
+    {
+        std::lock_guard<std::mutex> lock(s_pool.mutex);
+        for (auto& [resourceId, resource] : s_pool.resources)
+        {
+            for (int i = 0; i < PRIORITY_COUNT; i++)
+            {
+                auto& queue = resource.queues[i];
+                for (auto it = queue.begin(); it != queue.end(); ++it)
+                {
+                    if (it->id == id)
+                    {
+                        queue.erase(it);
+                        resource.stats.queued--;
+                        s_pool.queueStats[i].depth--;
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    void GetQueueStats(QueueStats (&stats)[PRIORITY_COUNT], bool reset)
+    {
+        std::lock_guard<std::mutex> lock(s_pool.mutex);
+        for (int i = 0; i < PRIORITY_COUNT; i++)
+        {
+            stats[i] = s_pool.queueStats[i];
+            // the depth is the current state, not a counter
+            if (reset)
+            {
+                s_pool.queueStats[i]       = {};
+                s_pool.queueStats[i].depth = stats[i].depth;
+            }
+        }
+    }
+
+    std::map<ResourceId, ResourceStats> GetResourceStats(bool reset)
+    {
+        std::lock_guard<std::mutex> lock(s_pool.mutex);
+
+        std::map<ResourceId, ResourceStats> stats;
+        for (auto& [id, resource] : s_pool.resources)
+        {
+            stats[id] = resource.stats;
+            // queued and running are the current state, not counters
+            if (reset)
+            {
+                resource.stats         = {};
+                resource.stats.queued  = stats[id].queued;
+                resource.stats.running = stats[id].running;
+            }
+        }
+        return stats;
+    }
+} // namespace module